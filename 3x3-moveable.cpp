@@ -5,27 +5,126 @@
 #include <algorithm>
 #include <chrono>
 #include <tuple>
-#include <list>
+#include <unordered_map>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include "engine.h"
 
 using namespace std;
 
-const vector<vector<int>> win_conditions = {{0, 1, 2}, {3, 4, 5}, {6, 7, 8}, {0, 3, 6}, {1, 4, 7}, {2, 5, 8}, {0, 4, 8}, {2, 4, 6}};
+using Game = Geometry<3, 3, MoveableRules>;
+static_assert(Game::rules::piece_limit == 3, "MoveableState holds three pieces per player");
 
-void display_board(const vector<int>& gameboard, const list<int>& player_positions, const list<int>& ai_positions) {
-    for (int i = 0; i < 9; ++i) {
+size_t tt_size_mb = 16; // Transposition table size in megabytes (rounded down to a power of two), set with --hash MB
+bool show_pv = false; // Print the score and principal variation of every iteration of the search (--pv)
+
+// The whole game in one 64-bit word. The low 18 bits are the occupied cells, 9 per player (player 1 first). Above
+// them each player has 14 bits holding their pieces in the order they were placed: three 4-bit cell indices, oldest
+// in the lowest bits, then a 2-bit count. Equal games always pack to the same word, so it doubles as a hash key.
+struct MoveableState {
+    static constexpr int queue_shift = 2 * Game::cells;
+    static_assert(Game::cells <= 16 && queue_shift + 28 <= 64, "cells must fit in 4 bits and the queues in the word");
+
+    uint64_t bits = 0;
+
+    uint32_t pieces(int player) const {
+        return bits >> (Game::cells * side(player)) & Game::full_board;
+    }
+
+    uint32_t empty_cells() const {
+        return ~(bits | bits >> Game::cells) & Game::full_board;
+    }
+
+    int at(int cell) const {
+        if (bits >> cell & 1) return 1;
+        if (bits >> (cell + Game::cells) & 1) return -1;
+        return 0;
+    }
+
+    int count(int player) const {
+        return queue(player) >> 12;
+    }
+
+    // The i-th oldest piece; piece(player, 0) is the next one to be lifted
+    int piece(int player, int i) const {
+        return queue(player) >> (4 * i) & 0xF;
+    }
+
+    // Places a piece for player. With three already down the oldest is lifted first; it is returned so that
+    // unmake_move can put it back (-1 if nothing was lifted).
+    int make_move(int cell, int player) {
+        uint32_t q = queue(player);
+        int size = q >> 12;
+        int removed = -1;
+        if (size == 3) {
+            removed = q & 0xF;
+            bits &= ~(1ull << (removed + Game::cells * side(player)));
+            q = (q & 0x3000) | (q & 0xFFF) >> 4 | cell << 8;
+        } else {
+            q = (q | cell << (4 * size)) + (1 << 12);
+        }
+        bits |= 1ull << (cell + Game::cells * side(player));
+        set_queue(player, q);
+        return removed;
+    }
+
+    void unmake_move(int cell, int player, int removed) {
+        uint32_t q = queue(player);
+        if (removed >= 0) {
+            q = (q & 0x3000) | (q << 4 & 0xFFF) | removed;
+            bits |= 1ull << (removed + Game::cells * side(player));
+        } else {
+            q -= 1 << 12;
+            q &= ~(0xFu << (4 * (q >> 12)));
+        }
+        bits &= ~(1ull << (cell + Game::cells * side(player)));
+        set_queue(player, q);
+    }
+
+    // The same game with the players' colours exchanged
+    MoveableState swapped() const {
+        MoveableState s;
+        s.bits = (bits >> Game::cells & Game::full_board) | (bits & Game::full_board) << Game::cells | (uint64_t)queue(-1) << queue_shift | (uint64_t)queue(1) << (queue_shift + 14);
+        return s;
+    }
+
+    // splitmix64 finaliser over the packed word and the player to move
+    uint64_t hash(int player) const {
+        uint64_t z = bits ^ (player == 1 ? 0 : 1ull << 63);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint32_t queue(int player) const {
+        return bits >> (queue_shift + 14 * side(player)) & 0x3FFF;
+    }
+
+    void set_queue(int player, uint32_t q) {
+        int shift = queue_shift + 14 * side(player);
+        bits = (bits & ~(0x3FFFull << shift)) | (uint64_t)q << shift;
+    }
+};
+
+void display_board(const MoveableState& state) {
+    for (int i = 0; i < Game::cells; ++i) {
         char symbol;
         
-        if (gameboard[i] == 1) {
+        if (state.at(i) == 1) {
             symbol = 'O';
-        } else if (gameboard[i] == -1) {
+        } else if (state.at(i) == -1) {
             symbol = 'X';
         } else {
             symbol = ' ';
         }
 
-        if (!player_positions.empty() && i == player_positions.front()) {
+        if (state.count(1) > 0 && i == state.piece(1, 0)) {
             cout << "\033[31m" << symbol << "\033[0m";
-        } else if (!ai_positions.empty() && i == ai_positions.front()) {
+        } else if (state.count(-1) > 0 && i == state.piece(-1, 0)) {
             cout << "\033[34m" << symbol << "\033[0m";
         } else {
             cout << symbol;
@@ -42,34 +141,63 @@ void display_board(const vector<int>& gameboard, const list<int>& player_positio
     }
 }
 
-bool check_win(const vector<int>& gameboard, const int& player) {
-    for (const auto& condition : win_conditions) {
-        if (gameboard[condition[0]] == player && gameboard[condition[1]] == player && gameboard[condition[2]] == player) {
-            return true;
-        }
-    }
+bool check_win(const MoveableState& state, const int& player) {
+    return Game::has_line(state.pieces(player));
+}
 
-    return false;
+// Bitmask of the empty cells; iterate with __builtin_ctz
+uint32_t get_possible_moves(const MoveableState& state) {
+    return state.empty_cells();
 }
 
-vector<int> get_possible_moves(const vector<int>& gameboard) {
-    vector<int> possible_moves;
-    for (int i = 0; i < 9; ++i) {
-        if (gameboard[i] == 0) {
-            possible_moves.push_back(i);
+// Perft as in engine.h, with the oldest piece lifted by make_move once three are down. The board never fills, so
+// only a line ends a game.
+uint64_t perft(MoveableState& state, int player, int depth, uint64_t& ended) {
+    uint64_t nodes = 0;
+    for (uint32_t moves = get_possible_moves(state); moves; moves &= moves - 1) {
+        int move = __builtin_ctz(moves);
+        int removed = state.make_move(move, player);
+        bool over = check_win(state, player);
+        if (depth == 1) {
+            nodes++;
+            ended += over;
+        } else if (!over) {
+            nodes += perft(state, -player, depth - 1, ended);
         }
+        state.unmake_move(move, player, removed);
     }
-    return possible_moves;
+    return nodes;
 }
 
-int negamax(vector<int> gameboard, list<int> player_positions, list<int> opponent_positions, int player, int depth, int alpha, int beta) {
+// Perft from the empty board, {nodes, games ended on the last ply} per depth, from a separate brute-force count.
+// The first six plies match standard 3x3, the seventh is the first to lift a piece.
+const vector<pair<uint64_t, uint64_t>> perft_totals = {
+    {9, 0}, {72, 0}, {504, 0}, {3024, 0}, {15120, 1440}, {54720, 5328}, {148176, 15984}, {396576, 43248}, {1059984, 116400},
+    {2830752, 311544}, {7557624, 840480}, {20151432, 2221944}, {53788464, 5929248}, {143577648, 15681776},
+};
+
+int negamax(MoveableState& state, int player, int depth, int alpha, int beta, TranspositionTable& TT) {
+    int alpha_org = alpha;
+    searched_nodes++;
+    uint64_t hash = state.hash(player);
+
+    PrincipalVariation<Game>& pv = principal_variation<Game>;
+    int pv_move = pv.enter(depth);
+
+    // Transposition table lookup. Pieces move, so the same state turns up again at other depths; scores are
+    // relative to the remaining depth, so only an entry searched at exactly this depth can be reused. The state
+    // is hashed as is, with no symmetry.
+    int value, hash_move;
+    if (probe_table<Game>(hash, 0, depth, alpha, beta, TT, value, hash_move, true)) {
+        return value;
+    }
     
     // Terminal node checks
-    if (check_win(gameboard, player)) {
+    if (check_win(state, player)) {
         return depth;
     }
     
-    if (check_win(gameboard, -player)) {
+    if (check_win(state, -player)) {
         return -depth;
     }
     
@@ -78,90 +206,409 @@ int negamax(vector<int> gameboard, list<int> player_positions, list<int> opponen
     }
     
     int best_score = -10000; // Initial best score
+    int best_move = 0;
     int score;
     
-    // Copy values
-    list<int> player_positions_orig = player_positions;
-    vector<int> gameboard_orig = gameboard;
-    
-    for (int move : get_possible_moves(gameboard)) {
-        // Make move and update positions variable
-        gameboard[move] = player;
-        player_positions.push_back(move);
-        if (player_positions.size() == 4) {
-            gameboard[player_positions.front()] = 0;
-            player_positions.pop_front();
-        }
-        
-        // Use a null window search by calling negamax with a narrow window
-        score = -negamax(gameboard, opponent_positions, player_positions, -player, depth-1, -alpha-1, -alpha);
+    MoveOrdering<Game>& ordering = move_ordering<Game>;
+    int moves[Game::cells];
+    int move_count = ordering.order(get_possible_moves(state), pv_move >= 0 ? pv_move : hash_move, depth, player, moves);
+
+    for (int i = 0; i < move_count; ++i) {
+        int move = moves[i];
+        int removed = state.make_move(move, player);
         
-        // If the score is inside the new window, re-evaluate with a proper window
-        if (alpha < score && score < beta) {
-            score = -negamax(gameboard, opponent_positions, player_positions, -player, depth-1, -beta, -score);
+        if (i == 0) {
+            // Principal variation search: the first move is expected to be best and gets the full window
+            score = -negamax(state, -player, depth-1, -beta, -alpha, TT);
+            pv.following = false;
+        } else {
+            // The rest only have to be shown worse, with a null window
+            score = -negamax(state, -player, depth-1, -alpha-1, -alpha, TT);
+            
+            // If the score is inside the new window, re-evaluate with a proper window
+            if (alpha < score && score < beta) {
+                score = -negamax(state, -player, depth-1, -beta, -score, TT);
+            }
         }
         
-        // Reset move and player position
-        gameboard = gameboard_orig;
-        player_positions = player_positions_orig;
+        state.unmake_move(move, player, removed);
                 
         if (score > best_score) {
             best_score = score;
+            best_move = move;
         }
         
+        if (score > alpha) {
+            pv.update(depth, move);
+        }
         alpha = max(alpha, score);
                 
         if (alpha >= beta) {
+            ordering.record_cutoff(move, i, depth, player);
             break;
         }
     }
     
+    store(TT, hash, alpha_org, beta, best_score, depth, best_move);
+
     return best_score;
 }
 
-tuple<int, int> solve(vector<int> gameboard, list<int> player_positions, list<int> opponent_positions, int player, int depth) {
-    int best_move, score;
-    int best_score = -10000; // Initial best score
-    int alpha = -10000; // Initial alpha range (lower bound)
-    int beta = 10000;   // Initial beta range (upper bound)
+// Iterative deepening up to depth, each iteration following the previous one's principal variation first.
+// table is kept by the caller from search to search when given, otherwise a fresh table is used.
+tuple<int, int> solve(MoveableState state, int player, int depth, TranspositionTable* table = nullptr) {
+    int best_move = -1, best_score = 0;
+    SearchStatsScope stats_scope;
     
-    // Copy values
-    list<int> player_positions_orig = player_positions;
-    vector<int> gameboard_orig = gameboard;
-        
-    for (int move : get_possible_moves(gameboard)) {
-        // Make move and update positions variable
-        gameboard[move] = player;
-        player_positions.push_back(move);
-        if (player_positions.size() == 4) {
-            gameboard[player_positions.front()] = 0;
-            player_positions.pop_front();
-        }
+    unique_ptr<TranspositionTable> local_table;
+    TranspositionTable& TT = select_table(table, nullptr, local_table, tt_size_mb);
+    TT.new_search(); // Entries from earlier searches are replaced first
+    move_ordering<Game>.new_search();
+    PrincipalVariation<Game>& pv = principal_variation<Game>;
+    pv.clear();
+    
+    for (int iteration = 1; iteration <= depth; ++iteration) {
+        int alpha = -10000; // Initial alpha range (lower bound)
+        int beta = 10000;   // Initial beta range (upper bound)
+        best_score = -10000;
         
-        // Use a null window search by calling negamax with a narrow window
-        score = -negamax(gameboard, opponent_positions, player_positions, -player, depth-1, -beta, -alpha);
+        MoveOrdering<Game>& ordering = move_ordering<Game>;
+        int moves[Game::cells];
+        int move_count = ordering.order(get_possible_moves(state), best_move, iteration, player, moves);
+        pv.start_pass(iteration);
         
-        // Reset move and player position
-        gameboard = gameboard_orig;
-        player_positions = player_positions_orig;
-                
-        if (score > best_score) {
-            best_score = score;
-            best_move = move;
+        for (int i = 0; i < move_count; ++i) {
+            int move = moves[i];
+            int removed = state.make_move(move, player);
+            
+            int score;
+            if (i == 0) {
+                score = -negamax(state, -player, iteration-1, -beta, -alpha, TT);
+                pv.following = false;
+            } else {
+                score = -negamax(state, -player, iteration-1, -alpha-1, -alpha, TT);
+                if (alpha < score && score < beta) {
+                    score = -negamax(state, -player, iteration-1, -beta, -score, TT);
+                }
+            }
+            
+            state.unmake_move(move, player, removed);
+                    
+            if (score > best_score) {
+                best_score = score;
+                best_move = move;
+            }
+            
+            // Update the alpha range based on the score
+            if (score > alpha) {
+                pv.update(iteration, move);
+            }
+            alpha = max(alpha, score);
         }
         
-        // Update the alpha range based on the score
-        alpha = max(alpha, score);
+        pv.keep();
+        ENGINE_STAT(search_stats.add_iteration(iteration));
+        if (show_pv) {
+            cout << "depth " << iteration << " score " << best_score << " pv";
+            for (int i = 0; i < pv.previous_length; ++i) {
+                cout << " " << pv.previous[i] + 1;
+            }
+            cout << endl;
+        }
     }
     
     return make_tuple(best_move, best_score);
 }
 
-int main() {
-    vector<int> gameboard(9, 0);
+// Perfect play over the full state graph. A state is the game seen by the player to move, with their pieces as
+// player 1 and the opponent's as player -1, so the key is just MoveableState::bits. The graph has cycles, so
+// instead of a depth-bounded search it is solved by retrograde analysis: states where the opponent has a line
+// are losses, a state with a move into a loss is a win, a state whose moves all lead to wins is a loss, and
+// whatever is never resolved can be kept going forever and is a draw. Resolving states in order of distance gives
+// the fastest win and the slowest loss.
+enum StateResult { UNRESOLVED = 0, LOSS = 1, DRAW = 2, WIN = 3 };
+
+// The state after the player to move plays move, from the opponent's point of view
+inline uint64_t child_key(MoveableState state, int move) {
+    state.make_move(move, 1);
+    return state.swapped().bits;
+}
+
+struct PerfectPlayTable {
+    unordered_map<uint64_t, int> index;
+    vector<uint64_t> keys;
+    vector<uint8_t> results;
+    vector<uint8_t> distances; // Plies until the game ends under perfect play (unused for draws)
+
+    int state_index(uint64_t key) const {
+        auto it = index.find(key);
+        return it == index.end() ? -1 : it->second;
+    }
+};
+
+PerfectPlayTable build_perfect_play_table() {
+    PerfectPlayTable table;
+    vector<vector<int>> predecessors;
+    vector<int> unresolved_moves;
+    vector<int> frontier;
+
+    auto add_state = [&](uint64_t key) {
+        auto inserted = table.index.emplace(key, table.keys.size());
+        if (inserted.second) {
+            table.keys.push_back(key);
+            predecessors.emplace_back();
+        }
+        return inserted.first->second;
+    };
+
+    // Forward pass: every state reachable from the empty board, with its predecessors
+    add_state(MoveableState().bits);
+    for (size_t i = 0; i < table.keys.size(); ++i) {
+        MoveableState state{table.keys[i]};
+
+        int moves = 0;
+        if (!check_win(state, 1) && !check_win(state, -1)) {
+            for (uint32_t possible = get_possible_moves(state); possible; possible &= possible - 1) {
+                int child = add_state(child_key(state, __builtin_ctz(possible)));
+                predecessors[child].push_back(i);
+                moves++;
+            }
+        }
+        unresolved_moves.push_back(moves);
+    }
+
+    table.results.assign(table.keys.size(), UNRESOLVED);
+    table.distances.assign(table.keys.size(), 0);
+
+    // Terminal states, in the same order negamax checks them
+    for (size_t i = 0; i < table.keys.size(); ++i) {
+        MoveableState state{table.keys[i]};
+        if (check_win(state, 1)) {
+            table.results[i] = WIN;
+            frontier.push_back(i);
+        } else if (check_win(state, -1)) {
+            table.results[i] = LOSS;
+            frontier.push_back(i);
+        }
+    }
+
+    // Backward pass, one distance layer at a time
+    for (size_t next = 0; next < frontier.size(); ++next) {
+        int child = frontier[next];
+        for (int parent : predecessors[child]) {
+            if (table.results[parent] != UNRESOLVED) {
+                continue;
+            }
+
+            if (table.results[child] == LOSS) {
+                table.results[parent] = WIN;
+                table.distances[parent] = table.distances[child] + 1;
+                frontier.push_back(parent);
+            } else if (--unresolved_moves[parent] == 0) {
+                table.results[parent] = LOSS;
+                table.distances[parent] = table.distances[child] + 1;
+                frontier.push_back(parent);
+            }
+        }
+    }
+
+    for (uint8_t& result : table.results) {
+        if (result == UNRESOLVED) {
+            result = DRAW;
+        }
+    }
+
+    return table;
+}
+
+// Best move for player from the table: the fastest win, else the first drawing move, else the slowest loss.
+// The score uses negamax's scale at the given depth (a win in n plies scores depth - n), with draws at 0.
+tuple<int, int> solve_perfect(const PerfectPlayTable& table, const MoveableState& state, int player, int depth) {
+    SearchStatsScope stats_scope;
+    MoveableState own_view = player == 1 ? state : state.swapped();
+    int best_move = -1, best_rank = -10000;
+
+    for (uint32_t moves = get_possible_moves(own_view); moves; moves &= moves - 1) {
+        int move = __builtin_ctz(moves);
+        int child = table.state_index(child_key(own_view, move));
+        int distance = table.distances[child] + 1;
+        int rank;
+        if (table.results[child] == LOSS) {
+            rank = 1000 - distance;
+        } else if (table.results[child] == DRAW) {
+            rank = 0;
+        } else {
+            rank = -1000 + distance;
+        }
+
+        if (rank > best_rank) {
+            best_rank = rank;
+            best_move = move;
+        }
+    }
+
+    int score = 0;
+    if (best_rank > 0) {
+        score = depth - (1000 - best_rank);
+    } else if (best_rank < 0) {
+        score = -(depth - (1000 + best_rank));
+    }
+    return make_tuple(best_move, score);
+}
+
+// Text dump of the table, one state per line: own pieces and opponent pieces (cells oldest first, '-' if none),
+// result for the player to move (W/D/L), plies to the end of the game and the best move (-1 if the game is over)
+void write_perfect_play_table(const PerfectPlayTable& table, const string& path) {
+    ofstream file(path);
+    const char result_names[] = {'?', 'L', 'D', 'W'};
+
+    for (size_t i = 0; i < table.keys.size(); ++i) {
+        MoveableState state{table.keys[i]};
+
+        string own_str, opponent_str;
+        for (int j = 0; j < state.count(1); ++j) {
+            own_str += to_string(state.piece(1, j));
+        }
+        for (int j = 0; j < state.count(-1); ++j) {
+            opponent_str += to_string(state.piece(-1, j));
+        }
+
+        int best_move = -1;
+        if (!check_win(state, 1) && !check_win(state, -1)) {
+            best_move = get<0>(solve_perfect(table, state, 1, 0));
+        }
+
+        file << (own_str.empty() ? "-" : own_str) << " " << (opponent_str.empty() ? "-" : opponent_str) << " " << result_names[table.results[i]] << " " << (int)table.distances[i] << " " << best_move << "\n";
+    }
+    cout << "Wrote " << table.keys.size() << " states to " << path << endl;
+}
+
+// Batch mode position: the pieces of the player to move, then the opponent's, each oldest first as cell digits
+// 0-8 or '-' for none (the first two fields of --emit-table lines). The player to move is -1, as the AI is in play.
+bool parse_state(const string& own_str, const string& opponent_str, MoveableState& state) {
+    state = MoveableState();
+    if (own_str.empty() || opponent_str.empty()) {
+        return false;
+    }
+
+    for (int player : {-1, 1}) {
+        const string& pieces = player == -1 ? own_str : opponent_str;
+        if (pieces == "-") {
+            continue;
+        }
+        if (pieces.size() > 3) {
+            return false;
+        }
+        for (char c : pieces) {
+            if (c < '0' || c > '8' || state.at(c - '0') != 0) {
+                return false;
+            }
+            state.make_move(c - '0', player);
+        }
+    }
+
+    // The player to move has placed as many pieces as the opponent, or one fewer
+    int difference = state.count(1) - state.count(-1);
+    return difference == 0 || difference == 1;
+}
+
+// Fixed corpus for --bench, positions as in batch mode (own pieces, then the opponent's): the empty board, an opening
+// and a few positions from the perfect-play table (won, drawn and lost), each searched to depth 20
+void benchmark_corpus(int warmup, int reps) {
+    const vector<pair<string, string>> positions = {{"-", "-"}, {"-", "4"}, {"21", "053"}, {"31", "082"}, {"310", "284"}, {"456", "830"}};
+
+    vector<BenchmarkCase> cases;
+    for (const auto& [own_str, opponent_str] : positions) {
+        MoveableState state;
+        parse_state(own_str, opponent_str, state);
+        cases.push_back({own_str + " " + opponent_str, [] {
+            move_ordering<Game>.clear();
+        }, [state] {
+            return solve(state, -1, 20);
+        }});
+    }
+    run_benchmark("3x3-moveable", cases, warmup, reps, cout);
+}
+
+int main(int argc, char* argv[]) {
+    MoveableState state;
     string input;
     int move, turn, score;
-    list<int> player_positions, ai_positions;
+    bool use_search = false;
+    int threads = max(1u, thread::hardware_concurrency());
+    string batch_path;
+    string stats_path;
+    bool bench = false;
+    int bench_reps = 5, bench_warmup = 1;
+
+    PerfectPlayTable table = build_perfect_play_table();
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--emit-table" && i + 1 < argc) {
+            write_perfect_play_table(table, argv[i + 1]); // e.g. ./3x3-moveable --emit-table 3x3-moveable_table.txt
+            return 0;
+        } else if (arg == "--search") {
+            use_search = true; // Depth-limited negamax instead of the perfect-play table
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_path = argv[++i]; // One line of JSON per AI move, "-" for standard output
+        } else if (arg == "--perft" && i + 1 < argc) {
+            MoveableState start;
+            return run_perft(atoi(argv[++i]), perft_totals, [&](int depth, uint64_t& ended) { return perft(start, 1, depth, ended); }) ? 0 : 1;
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--bench-reps" && i + 1 < argc) {
+            bench_reps = max(1, atoi(argv[++i]));
+        } else if (arg == "--bench-warmup" && i + 1 < argc) {
+            bench_warmup = max(0, atoi(argv[++i]));
+        } else if (arg == "--pv") {
+            show_pv = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--hash" && i + 1 < argc) {
+            tt_size_mb = max(1, atoi(argv[++i]));
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch_path = argv[++i]; // "-" reads standard input
+        } else {
+            cerr << "Usage: " << argv[0] << " [--search] [--pv] [--stats FILE] [--bench] [--bench-reps N] [--bench-warmup N] [--perft N] [--emit-table FILE] [--batch FILE] [--threads N] [--hash MB]" << endl;
+            return 1;
+        }
+    }
+
+    if (bench) {
+        show_pv = false;
+        benchmark_corpus(bench_warmup, bench_reps);
+        return 0;
+    }
+
+    // Batch positions are spread over the threads. States the perfect-play table never reaches are searched.
+    if (!batch_path.empty()) {
+        show_pv = false;
+        auto analyse_line = [&](const string& line) {
+            string own_str, opponent_str;
+            istringstream(line) >> own_str >> opponent_str;
+
+            MoveableState position;
+            if (!parse_state(own_str, opponent_str, position)) {
+                cerr << "Skipping invalid position: " << line << endl;
+                return string();
+            }
+
+            return batch_line(own_str + " " + opponent_str, [&] {
+                if (check_win(position, -1)) {
+                    return make_tuple(-1, 20);
+                }
+                if (check_win(position, 1)) {
+                    return make_tuple(-1, -20);
+                }
+                if (use_search || table.state_index(position.swapped().bits) < 0) {
+                    return solve(position, -1, 20, batch_table(tt_size_mb));
+                }
+                return solve_perfect(table, position, -1, 20);
+            });
+        };
+        return run_batch_file(batch_path, threads, analyse_line) ? 0 : 1;
+    }
     
     cout << "Would you like to be player 1 or 2 (enter 'exit' to quit): ";
     while (true) {
@@ -181,7 +628,7 @@ int main() {
     }
     
     while (true) {
-        display_board(gameboard, player_positions, ai_positions);
+        display_board(state);
         cout << endl;
         
         if (turn == 1) {
@@ -195,7 +642,7 @@ int main() {
                 }
 
                 stringstream ss(input);
-                if (!(ss >> move) || move < 1 || move > 9 || gameboard[move - 1] != 0) {
+                if (!(ss >> move) || move < 1 || move > 9 || state.at(move - 1) != 0) {
                     cout << "Invalid input. Please enter a number between 1 and 16 or 'exit'." << endl;
                     continue;
                 }
@@ -203,19 +650,12 @@ int main() {
                 break;
             }
             
-            move = move - 1;
-            gameboard[move] = 1;
-            
-            // Keep track of previous moves for moveability
-            player_positions.push_back(move);
-            if (player_positions.size() == 4) {
-                gameboard[player_positions.front()] = 0;
-                player_positions.pop_front();
-            }
+            // Lifts the oldest piece once three are down
+            state.make_move(move - 1, 1);
 
             // Check if the human player has won
-            if (check_win(gameboard, 1)) {
-                display_board(gameboard, player_positions, ai_positions);
+            if (check_win(state, 1)) {
+                display_board(state);
                 cout << endl << "Human player wins!" << endl;
                 exit(0);
             }
@@ -227,26 +667,23 @@ int main() {
             // Get the AI move
             auto start_time = chrono::high_resolution_clock::now(); // Start measuring time
             
-            tuple<int, int> result = solve(gameboard, ai_positions, player_positions, -1, 20);
+            tuple<int, int> result = use_search ? solve(state, -1, 20) : solve_perfect(table, state, -1, 20);
             move = get<0>(result);
             score = get<1>(result);
             
-            gameboard[move] = -1;
-            
-            // Keep track of previous moves for moveability
-            ai_positions.push_back(move);
-            if (ai_positions.size() == 4) {
-                gameboard[ai_positions.front()] = 0;
-                ai_positions.pop_front();
-            }
+            state.make_move(move, -1);
             
             auto end_time = chrono::high_resolution_clock::now();  // Stop measuring time
             auto duration = chrono::duration_cast<chrono::milliseconds>(end_time - start_time);
             cout << "AI evaluation: " << score << endl;
+            report_move_ordering<Game>();
+            if (!stats_path.empty()) {
+                write_search_stats(stats_path);
+            }
             cout << "AI move took " << duration.count() << " milliseconds to calculate." << endl << endl; // Show time to calculate move
 
-            if (check_win(gameboard, -1)) {
-                display_board(gameboard, player_positions, ai_positions);
+            if (check_win(state, -1)) {
+                display_board(state);
                 cout << "AI player wins!" << endl;
                 exit(0);
             }
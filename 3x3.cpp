@@ -1,168 +1,119 @@
 #include <iostream>
-#include <vector>
 #include <string>
 #include <sstream>
 #include <algorithm>
 #include <chrono>
 #include <tuple>
-#include <map>
-#include <fstream>
+#include <thread>
+#include <memory>
+#include <cstdlib>
+#include "engine.h"
 
 using namespace std;
 
-const vector<vector<int>> win_conditions = {{0, 1, 2}, {3, 4, 5}, {6, 7, 8}, {0, 3, 6}, {1, 4, 7}, {2, 5, 8}, {0, 4, 8}, {2, 4, 6}};
-
-void display_board(const vector<int>& gameboard) {
-    for (int i = 0; i < 9; ++i) {
-        char symbol = (gameboard[i] == 1) ? 'O' : ((gameboard[i] == -1) ? 'X' : ' ');
-        cout << symbol;
-        if ((i + 1) % 3 == 0) {
-            cout << endl;
-            if (i < 8) {
-                cout << "---------" << endl;
-            }
-        } else {
-            cout << " | ";
-        }
-    }
+using Game = Geometry<3, 3, LineRules>;
+using Board = BitBoard<Game>;
+
+size_t tt_size_mb = 1; // Transposition table size in megabytes (rounded down to a power of two), set with --hash MB
+const char cache_tag[8] = {'T', 'T', 'T', '3', 'X', '3', 'V', '2'}; // Marks cache files holding 3x3 results
+unique_ptr<TranspositionTable> cache_table; // Table kept in a file across runs, set with --cache FILE
+
+// Perft from the empty board, {nodes, games ended on the last ply} per depth: the well-known 255168 games
+const vector<pair<uint64_t, uint64_t>> perft_totals = {
+    {9, 0}, {72, 0}, {504, 0}, {3024, 0}, {15120, 1440}, {54720, 5328}, {148176, 47952}, {200448, 72576}, {127872, 127872},
+};
+
+// table is the game's own table when given, kept from move to move; otherwise the --cache file or a fresh table
+tuple<int, int> solve(Board gameboard, int player, int depth, TranspositionTable* table = nullptr) {
+    SearchStatsScope stats_scope;
+    unique_ptr<TranspositionTable> local_table;
+    TranspositionTable& TT = select_table(table, cache_table.get(), local_table, tt_size_mb);
+    TT.new_search(); // Entries from earlier moves are replaced first
+    move_ordering<Game>.new_search();
+    return search_root(gameboard, player, depth, TT);
 }
 
-bool check_win(const vector<int>& gameboard, const int& player) {
-    for (const auto& condition : win_conditions) {
-        if (gameboard[condition[0]] == player && gameboard[condition[1]] == player && gameboard[condition[2]] == player) {
-            return true;
-        }
-    }
-
-    return false;
+// Batch mode: each position solved to the end, see analyse_batch_line
+string analyse_line(const string& line) {
+    return analyse_batch_line<Game>(line, solve_depth<Game>, tt_size_mb, cache_table.get(), solve);
 }
 
-vector<int> get_possible_moves(const vector<int>& gameboard) {
-    vector<int> possible_moves;
-    for (int i = 0; i < 9; ++i) {
-        if (gameboard[i] == 0) {
-            possible_moves.push_back(i);
-        }
+// Fixed corpus for --bench, boards as in batch mode: the empty board and a few openings, each solved to the end
+void benchmark_corpus(int warmup, int reps) {
+    const vector<string> boards = {"000000000", "000010000", "100000000", "1-10010000", "1000-10001"};
+
+    TranspositionTable bench_table(tt_size_mb);
+    vector<BenchmarkCase> cases;
+    for (const string& board_str : boards) {
+        Board gameboard;
+        parse_board(board_str, gameboard);
+        int player = player_to_move(gameboard);
+        cases.push_back({board_str, [&] {
+            bench_table.clear();
+            move_ordering<Game>.clear();
+        }, [&bench_table, gameboard, player] {
+            return solve(gameboard, player, solve_depth(gameboard), &bench_table);
+        }});
     }
-    return possible_moves;
+    run_benchmark("3x3", cases, warmup, reps, cout);
 }
 
-void store(map<string, vector<int>>& table, string board, int alpha_org, int beta, int best_score, int depth) {
-    string flag;
-    if (best_score <= alpha_org) {
-        flag = "UPPERCASE";
-    } else if (best_score >= beta) {
-        flag = "LOWERCASE";
-    } else {
-        flag = "EXACT";
+int main(int argc, char* argv[]) {
+    Board gameboard;
+    string input;
+    int move, turn, score;
+    int threads = max(1u, thread::hardware_concurrency());
+    string batch_path;
+    string stats_path;
+    string cache_path;
+    bool bench = false;
+    int bench_reps = 5, bench_warmup = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--hash" && i + 1 < argc) {
+            tt_size_mb = max(1, atoi(argv[++i]));
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch_path = argv[++i]; // "-" reads standard input
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_path = argv[++i]; // One line of JSON per AI move, "-" for standard output
+        } else if (arg == "--perft" && i + 1 < argc) {
+            Board start;
+            return run_perft(atoi(argv[++i]), perft_totals, [&](int depth, uint64_t& ended) { return perft(start, 1, depth, ended); }) ? 0 : 1;
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--bench-reps" && i + 1 < argc) {
+            bench_reps = max(1, atoi(argv[++i]));
+        } else if (arg == "--bench-warmup" && i + 1 < argc) {
+            bench_warmup = max(0, atoi(argv[++i]));
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [--batch FILE] [--threads N] [--hash MB] [--cache FILE] [--stats FILE] [--bench] [--bench-reps N] [--bench-warmup N] [--perft N]" << endl;
+            return 1;
+        }
     }
 
-    vector<int> entry = {best_score, depth};
-    entry.push_back(flag == "EXACT" ? 0 : (flag == "LOWERCASE" ? -1 : 1));
-    table[board] = entry;
-}
-
-int negamax(vector<int> gameboard, int player, int depth, int alpha, int beta, map<string, vector<int>>& TT) {
-    int alpha_org = alpha;
-
-    // Transposition table lookup
-    string board_str;
-    for (int i : gameboard) {
-        board_str += to_string(i);
+    if (!cache_path.empty()) {
+        cache_table.reset(new TranspositionTable(tt_size_mb, cache_path, cache_tag));
     }
 
-    if (TT.find(board_str) != TT.end()) {
-        // Get TT data
-        vector<int> tt_entry = TT[board_str];
-        int tt_value = tt_entry[0];
-        int tt_depth = tt_entry[1];
-        int tt_flag = tt_entry[2];
-        
-        if (tt_depth >= depth) {
-
-            if (tt_flag == 0) {
-                return tt_value;
-            } else if (tt_flag == -1) {
-                alpha = max(alpha, tt_value);
-            } else if (tt_flag == 1) {
-                beta = min(beta, tt_value);
-            }
-
-            if (alpha >= beta) {
-                return tt_value;
-            }
-        }
-    }
-    
-    // Terminal node checks
-    if (check_win(gameboard, player)) {
-        return depth;
-    }
-    
-    if (check_win(gameboard, -player)) {
-        return -depth;
-    }
-    
-    if (find(gameboard.begin(), gameboard.end(), 0) == gameboard.end()) {
+    if (bench) {
+        benchmark_corpus(bench_warmup, bench_reps);
         return 0;
     }
-    
-    if (depth == 0) {
-        return 0;
-    }
-    
-    int best_score = -10000; // Initial best score
-    int score;
-    
-    for (int move : get_possible_moves(gameboard)) {
-        gameboard[move] = player;
-        score = -negamax(gameboard, -player, depth-1, -beta, -alpha, TT);
-        gameboard[move] = 0;
-                
-        if (score > best_score) {
-            best_score = score;
-        }
-        
-        alpha = max(alpha, score);
-        
-        if (alpha >= beta) {
-            break;
-        }
-    }
-    
-    store(TT, board_str, alpha_org, beta, best_score, depth);
-    
-    return best_score;
-}
-
-tuple<int, int> solve(vector<int> gameboard, int player, int depth) {
-    int best_move, score;
-    int best_score = -10000; // Initial best score
-    int alpha = -10000; // Initial alpha value
-    int beta = 10000;   // Initial beta value
-    
-    map<string, vector<int>> TT;
-    
-    for (int move : get_possible_moves(gameboard)) {
-        gameboard[move] = player;
-        score = -negamax(gameboard, -player, depth-1, -beta, -alpha, TT);
-        gameboard[move] = 0;
-                
-        if (score > best_score) {
-            best_score = score;
-            best_move = move;
-        }
 
-        alpha = max(alpha, score);
+    if (!batch_path.empty()) {
+        return run_batch_file(batch_path, threads, analyse_line) ? 0 : 1;
     }
-    
-    return make_tuple(best_move, best_score);
-}
 
-int main() {
-    vector<int> gameboard(9, 0);
-    string input;
-    int move, turn, score;
+    // Kept for the whole game (unless the --cache file is), so each search starts from what the last one found
+    unique_ptr<TranspositionTable> game_table;
+    if (!cache_table) {
+        game_table.reset(new TranspositionTable(tt_size_mb));
+    }
     
     cout << "Would you like to be player 1 or 2 (enter 'exit' to quit): ";
     while (true) {
@@ -196,12 +147,12 @@ int main() {
                 }
 
                 stringstream ss(input);
-                if (!(ss >> move) || move < 1 || move > 9 || gameboard[move - 1] != 0) {
+                if (!(ss >> move) || move < 1 || move > 9 || gameboard.at(move - 1) != 0) {
                     cout << "Invalid input. Please enter a number between 1 and 9 or 'exit'." << endl;
                     continue;
                 }
 
-                gameboard[move - 1] = 1;
+                gameboard.make_move(move - 1, 1);
                 break;
             }
 
@@ -212,7 +163,7 @@ int main() {
                 exit(0);
             }
 
-            if (find(gameboard.begin(), gameboard.end(), 0) == gameboard.end()) {
+            if (gameboard.empty_cells() == 0) {
                 display_board(gameboard);
                 cout << endl << "Game was a draw." << endl;
                 exit(0);
@@ -225,14 +176,19 @@ int main() {
             // Get the AI move
             auto start_time = chrono::high_resolution_clock::now(); // Start measuring time
             
-            tuple<int, int> result = solve(gameboard, -1, 9);
+            tuple<int, int> result = solve(gameboard, -1, solve_depth(gameboard), game_table.get());
             move = get<0>(result);
             score = get<1>(result);
             
-            gameboard[move] = -1;
+            gameboard.make_move(move, -1);
             auto end_time = chrono::high_resolution_clock::now();  // Stop measuring time
             auto duration = chrono::duration_cast<chrono::milliseconds>(end_time - start_time);
             cout << "AI evaluation: " << score << endl;
+            report_move_ordering<Game>();
+            report_table_hits();
+            if (!stats_path.empty()) {
+                write_search_stats(stats_path);
+            }
             cout << "AI move took " << duration.count() << " milliseconds to calculate." << endl << endl; // Show time to calculate move
 
             if (check_win(gameboard, -1)) {
@@ -241,7 +197,7 @@ int main() {
                 exit(0);
             }
 
-            if (find(gameboard.begin(), gameboard.end(), 0) == gameboard.end()) {
+            if (gameboard.empty_cells() == 0) {
                 display_board(gameboard);
                 cout << endl << "Game was a draw." << endl;
                 exit(0);
@@ -5,19 +5,44 @@
 #include <algorithm>
 #include <chrono>
 #include <tuple>
-#include <map>
 #include <fstream>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "engine.h"
 
 using namespace std;
 
-const vector<vector<int>> win_conditions = {{0,1,2,3},{4,5,6,7},{8,9,10,11},{12,13,14,15},{0,4,8,12},{1,5,9,13},{2,6,10,14},{3,7,11,15},{0,5,10,15},{3,6,9,12}, {0,3,12,15}, {0,1,4,5}, {1,2,5,6}, {2,3,6,7}, {4,5,8,9}, {5,6,9,10}, {6,7,10,11}, {8,9,12,13}, {9,10,13,14}, {10,11,14,15}}; // https://mamabeefromthehive.blogspot.com/2012/01/4-square-tic-tac-toe.html for more info on 4x4 rules
+using Game = Geometry<4, 4, SquareRules>; // https://mamabeefromthehive.blogspot.com/2012/01/4-square-tic-tac-toe.html for more info on 4x4 rules
+using Board = BitBoard<Game>;
 
-vector<tuple<string, int, int>> load_dictionary() {
+size_t tt_size_mb = 64; // Transposition table size in megabytes (rounded down to a power of two), set with --hash MB
+const char cache_tag[8] = {'T', 'T', 'T', '4', 'X', '4', 'V', '2'}; // Marks cache files holding 4x4 results
+unique_ptr<TranspositionTable> cache_table; // Table kept in a file across runs, set with --cache FILE
+// Perft from the empty board, {nodes, games ended on the last ply} per depth, from a separate brute-force count
+const vector<pair<uint64_t, uint64_t>> perft_totals = {
+    {16, 0}, {240, 0}, {3360, 0}, {43680, 0}, {524160, 0}, {5765760, 0}, {57657600, 633600}, {513216000, 5612544},
+};
+const int split_plies = 3; // Plies below the root at which the parallel solver splits work between threads
+int search_threads = max(1u, thread::hardware_concurrency()); // Threads used by solve(), set with --threads N
+
+vector<tuple<string, int, int>> load_dictionary(const string& path) {
     vector<tuple<string, int, int>> dictionary;
     string board, row;
     int move, score;
     
-    ifstream file("4x4_dict.txt");
+    ifstream file(path);
     if (file.is_open()) {
         while (getline(file, row)) {
             if (file >> board >> move >> score) {
@@ -35,161 +60,784 @@ vector<tuple<string, int, int>> load_dictionary() {
     return dictionary;
 }
 
-void display_board(const vector<int>& gameboard) {
-    for (int i = 0; i < 16; ++i) {
-        char symbol = (gameboard[i] == 1) ? 'O' : ((gameboard[i] == -1) ? 'X' : ' ');
-        cout << symbol;
-        if ((i + 1) % 4 == 0) {
-            cout << endl;
-            if (i < 15) {
-                cout << "-------------" << endl;
-            }
-        } else {
-            cout << " | ";
-        }
+// Canonical image of the board packed as O bits | X bits << 16, plus the symmetry that produced it
+uint32_t book_key(const Board& gameboard, int& symmetry) {
+    symmetry = canonical_symmetry(gameboard);
+    return Game::transform(gameboard.bits[0], symmetry) | Game::transform(gameboard.bits[1], symmetry) << 16;
+}
+
+// Binary opening book: a header followed by entries sorted by key, with moves in the canonical frame
+struct BookHeader {
+    char magic[8];
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct BookEntry {
+    uint32_t key;
+    int8_t move;
+    int8_t score;
+    uint16_t reserved;
+};
+
+const char book_magic[8] = {'T', 'T', 'T', 'B', 'O', 'O', 'K', '3'}; // Version 3: scores on the search's scale
+
+// The dictionary was searched 16 plies deep from every position, so its wins and losses count the plies left out
+// of 16. The search now goes to solve_depth(), so the book stores them out of that instead.
+int rescale_dictionary_score(const Board& gameboard, int score) {
+    int shift = Game::cells - solve_depth(gameboard);
+    return score > 0 ? score - shift : (score < 0 ? score + shift : 0);
+}
+
+void convert_dictionary(const string& text_path, const string& book_path) {
+    vector<BookEntry> entries;
+    for (const auto& row : load_dictionary(text_path)) {
+        int symmetry;
+        Board gameboard;
+        parse_board(get<0>(row), gameboard);
+        int score = rescale_dictionary_score(gameboard, get<2>(row));
+        BookEntry entry = {book_key(gameboard, symmetry), (int8_t)Game::symmetry_maps[symmetry][get<1>(row)], (int8_t)score, 0};
+        entries.push_back(entry);
+    }
+
+    sort(entries.begin(), entries.end(), [](const BookEntry& a, const BookEntry& b) { return a.key < b.key; });
+    entries.erase(unique(entries.begin(), entries.end(), [](const BookEntry& a, const BookEntry& b) { return a.key == b.key; }), entries.end());
+
+    BookHeader header = {};
+    memcpy(header.magic, book_magic, sizeof(book_magic));
+    header.count = entries.size();
+
+    ofstream file(book_path, ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)entries.data(), entries.size() * sizeof(BookEntry));
+    if (!file) {
+        cerr << "Unable to write " << book_path << endl;
+        exit(1);
     }
+    cout << "Wrote " << entries.size() << " positions to " << book_path << endl;
 }
 
-bool check_win(const vector<int>& gameboard, const int& player) {
-    for (const auto& condition : win_conditions) {
-        if (gameboard[condition[0]] == player && gameboard[condition[1]] == player && gameboard[condition[2]] == player && gameboard[condition[3]] == player) {
-            return true;
+// Read-only memory mapping of a whole file
+struct MappedFile {
+    void* data = nullptr;
+    size_t size = 0;
+
+    bool open_file(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            size = info.st_size;
+            data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if (data == nullptr || data == MAP_FAILED) {
+            data = nullptr;
+            return false;
         }
+        return true;
     }
 
-    return false;
-}
+    void close_file() {
+        if (data != nullptr) {
+            munmap(data, size);
+            data = nullptr;
+        }
+    }
+
+    ~MappedFile() {
+        close_file();
+    }
+};
+
+// Binary book mapped into memory, looked up by binary search
+struct OpeningBook {
+    MappedFile file;
+    const BookEntry* entries = nullptr;
+    size_t count = 0;
+
+    bool load(const string& path) {
+        if (!file.open_file(path)) {
+            return false;
+        }
 
-vector<int> get_possible_moves(const vector<int>& gameboard) {
-    vector<int> possible_moves;
-    for (int i = 0; i < 16; ++i) {
-        if (gameboard[i] == 0) {
-            possible_moves.push_back(i);
+        const BookHeader* header = (const BookHeader*)file.data;
+        if (file.size < sizeof(BookHeader) || memcmp(header->magic, book_magic, sizeof(book_magic)) != 0 || sizeof(BookHeader) + header->count * sizeof(BookEntry) > file.size) {
+            cerr << path << " is not a valid opening book." << endl;
+            file.close_file();
+            return false;
         }
+
+        entries = (const BookEntry*)(header + 1);
+        count = header->count;
+        return true;
     }
-    return possible_moves;
-}
 
-void store(map<string, vector<int>>& table, string board, int alpha_org, int beta, int best_score, int depth) {
-    string flag;
-    if (best_score <= alpha_org) {
-        flag = "UPPERCASE";
-    } else if (best_score >= beta) {
-        flag = "LOWERCASE";
-    } else {
-        flag = "EXACT";
+    bool lookup(const Board& gameboard, int& move, int& score) const {
+        int symmetry;
+        uint32_t key = book_key(gameboard, symmetry);
+        const BookEntry* end = entries + count;
+        const BookEntry* entry = lower_bound(entries, end, key, [](const BookEntry& e, uint32_t k) { return e.key < k; });
+        if (entry == end || entry->key != key) {
+            return false;
+        }
+        move = Game::inverse_symmetry_maps[symmetry][entry->move];
+        score = entry->score;
+        return true;
     }
+};
+
+// Endgame tablebase covering every position of the game, built by retrograde analysis.
+// Positions are indexed in base 3 (0 = empty, 1 = the first player's piece, 2 = the second player's), so whoever
+// started is always 1 and the side to move follows from the piece counts. Each position gets one byte from the
+// side to move's point of view: the result (bits 0-1) and the number of plies to the end of the game under
+// perfect play (bits 2-6), matching what negamax scores (win fast, lose slow).
+enum TablebaseResult { TB_NONE = 0, TB_LOSS = 1, TB_DRAW = 2, TB_WIN = 3 };
+
+const uint32_t tablebase_positions = 43046721; // 3^16
+const char tablebase_magic[8] = {'T', 'T', 'T', 'T', 'B', '4', 'X', '4'};
 
-    vector<int> entry = {best_score, depth};
-    entry.push_back(flag == "EXACT" ? 0 : (flag == "LOWERCASE" ? -1 : 1));
-    table[board] = entry;
+// Base-3 value of a bitboard, one lookup per byte
+array<array<uint32_t, 256>, 2> build_ternary_lut() {
+    array<array<uint32_t, 256>, 2> lut = {};
+    for (int chunk = 0; chunk < 2; ++chunk) {
+        for (int byte = 0; byte < 256; ++byte) {
+            uint32_t power = chunk == 0 ? 1 : 6561; // 3^8
+            for (int bit = 0; bit < 8; ++bit, power *= 3) {
+                if (byte >> bit & 1) {
+                    lut[chunk][byte] += power;
+                }
+            }
+        }
+    }
+    return lut;
 }
 
-int negamax(vector<int> gameboard, int player, int depth, int alpha, int beta, map<string, vector<int>>& TT) {
-    int alpha_org = alpha;
+static const array<array<uint32_t, 256>, 2> ternary_lut = build_ternary_lut();
+
+inline uint32_t ternary(uint32_t bits) {
+    return ternary_lut[0][bits & 0xFF] + ternary_lut[1][bits >> 8];
+}
 
-    // Transposition table lookup
-    string board_str;
-    for (int i : gameboard) {
-        board_str += to_string(i);
+// Sweeps the indices from high to low: a move only ever adds a digit, so every child is resolved before its parent
+void build_tablebase(const string& path) {
+    vector<uint8_t> table(tablebase_positions, 0);
+    array<uint32_t, 16> powers;
+    for (int cell = 0, power = 1; cell < 16; ++cell, power *= 3) {
+        powers[cell] = power;
     }
 
-    if (TT.find(board_str) != TT.end()) {
-        // Get TT data
-        vector<int> tt_entry = TT[board_str];
-        int tt_value = tt_entry[0];
-        int tt_depth = tt_entry[1];
-        int tt_flag = tt_entry[2];
-        
-        if (tt_depth >= depth) {
-
-            if (tt_flag == 0) {
-                return tt_value;
-            } else if (tt_flag == -1) {
-                alpha = max(alpha, tt_value);
-            } else if (tt_flag == 1) {
-                beta = min(beta, tt_value);
+    int digits[16];
+    fill(digits, digits + 16, 2);
+    uint32_t first = 0, second = Game::full_board; // Cells holding digit 1 and digit 2
+    uint64_t counts[4] = {0, 0, 0, 0};
+
+    auto start_time = chrono::high_resolution_clock::now();
+    for (uint32_t index = tablebase_positions; index-- > 0;) {
+        int first_count = __builtin_popcount(first), second_count = __builtin_popcount(second);
+
+        if (first_count == second_count || first_count == second_count + 1) {
+            bool first_to_move = first_count == second_count;
+            uint32_t own = first_to_move ? first : second;
+            uint32_t opponent = first_to_move ? second : first;
+            uint32_t own_digit = first_to_move ? 1 : 2;
+            int result, distance = 0;
+
+            // Same order of terminal checks as negamax
+            if (Game::has_line(own)) {
+                result = TB_WIN;
+            } else if (Game::has_line(opponent)) {
+                result = TB_LOSS;
+            } else if ((own | opponent) == Game::full_board) {
+                result = TB_DRAW;
+            } else {
+                int best_win = 100, best_loss = -1;
+                bool draw = false;
+                for (uint32_t moves = ~(own | opponent) & Game::full_board; moves; moves &= moves - 1) {
+                    uint8_t child = table[index + own_digit * powers[__builtin_ctz(moves)]];
+                    int child_distance = (child >> 2) + 1;
+                    if ((child & 3) == TB_LOSS) {
+                        best_win = min(best_win, child_distance);
+                    } else if ((child & 3) == TB_DRAW) {
+                        draw = true;
+                    } else {
+                        best_loss = max(best_loss, child_distance);
+                    }
+                }
+
+                if (best_win != 100) {
+                    result = TB_WIN;
+                    distance = best_win;
+                } else if (draw) {
+                    result = TB_DRAW;
+                } else {
+                    result = TB_LOSS;
+                    distance = best_loss;
+                }
             }
 
-            if (alpha >= beta) {
-                return tt_value;
+            table[index] = result | distance << 2;
+            counts[result]++;
+        }
+
+        // Step the base-3 digits and bitboards down to index - 1
+        for (int cell = 0; cell < 16; ++cell) {
+            uint32_t bit = 1u << cell;
+            if (digits[cell] > 0) {
+                digits[cell]--;
+                second &= ~bit;
+                if (digits[cell] == 1) {
+                    first |= bit;
+                } else {
+                    first &= ~bit;
+                }
+                break;
             }
+            digits[cell] = 2;
+            first &= ~bit;
+            second |= bit;
         }
     }
-    
-    // Terminal node checks
-    if (check_win(gameboard, player)) {
-        return depth;
+    auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start_time);
+
+    ofstream file(path, ios::binary);
+    file.write(tablebase_magic, sizeof(tablebase_magic));
+    file.write((const char*)table.data(), table.size());
+    if (!file) {
+        cerr << "Unable to write " << path << endl;
+        exit(1);
     }
-    
-    if (check_win(gameboard, -player)) {
-        return -depth;
+    cout << "Solved " << counts[TB_WIN] + counts[TB_DRAW] + counts[TB_LOSS] << " positions in " << duration.count() << " ms (" << counts[TB_WIN] << " wins, " << counts[TB_DRAW] << " draws, " << counts[TB_LOSS] << " losses for the side to move)" << endl;
+    cout << "Wrote " << path << endl;
+}
+
+struct Tablebase {
+    MappedFile file;
+    const uint8_t* table = nullptr;
+
+    bool load(const string& path) {
+        if (!file.open_file(path)) {
+            return false;
+        }
+        if (file.size != sizeof(tablebase_magic) + tablebase_positions || memcmp(file.data, tablebase_magic, sizeof(tablebase_magic)) != 0) {
+            cerr << path << " is not a valid tablebase." << endl;
+            file.close_file();
+            return false;
+        }
+        table = (const uint8_t*)file.data + sizeof(tablebase_magic);
+        return true;
     }
-    
-    if (find(gameboard.begin(), gameboard.end(), 0) == gameboard.end()) {
-        return 0;
+
+    bool loaded() const {
+        return table != nullptr;
     }
-    
-    if (depth == 0) {
+
+    // Score of the position for the player to move, on the same scale negamax uses at this depth
+    bool probe(const Board& gameboard, int player, int depth, int& score) const {
+        uint32_t own = gameboard.bits[side(player)], opponent = gameboard.bits[side(-player)];
+        int own_count = __builtin_popcount(own), opponent_count = __builtin_popcount(opponent);
+        if (own_count != opponent_count && own_count + 1 != opponent_count) {
+            return false;
+        }
+
+        // The player to move started the game if the piece counts are equal
+        uint32_t first = own_count == opponent_count ? own : opponent;
+        uint32_t second = first == own ? opponent : own;
+        uint8_t entry = table[ternary(first) + 2 * ternary(second)];
+        int distance = entry >> 2;
+
+        if ((entry & 3) == TB_WIN) {
+            score = depth - distance;
+        } else if ((entry & 3) == TB_LOSS) {
+            score = -(depth - distance);
+        } else {
+            score = 0;
+        }
+        return (entry & 3) != TB_NONE;
+    }
+};
+
+Tablebase tablebase;
+
+thread_local int worker_index = 0; // Index of the pool worker running on this thread (0 = the thread that called solve())
+
+// Work-stealing pool for the parallel solver. Every worker owns a deque: it pushes and pops its own tasks at the
+// back and, when that runs dry, steals the oldest task from the front of another worker's deque.
+// Worker 0 is the thread that called solve(); it takes part by running tasks while it waits for its split points.
+struct WorkStealingPool {
+    struct Queue {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> workers;
+    atomic<int> queued{0};
+    atomic<bool> done{false};
+    mutex sleep_lock;
+    condition_variable wake;
+    HelperCounters counters; // The workers' nodes and stats, added to the creating thread's when the pool closes
+
+    explicit WorkStealingPool(int threads) {
+        for (int i = 0; i < threads; ++i) {
+            queues.emplace_back(new Queue);
+        }
+        atomic<bool>* stop = stop_search; // Workers stop with the search that created the pool
+        for (int i = 1; i < threads; ++i) {
+            workers.emplace_back([this, i, stop] {
+                worker_index = i;
+                stop_search = stop;
+                while (!done) {
+                    if (!run_one()) {
+                        unique_lock<mutex> guard(sleep_lock);
+                        wake.wait_for(guard, chrono::milliseconds(1), [this] { return queued > 0 || done; });
+                    }
+                }
+                counters.collect();
+            });
+        }
+    }
+
+    ~WorkStealingPool() {
+        done = true;
+        wake.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+        counters.merge();
+    }
+
+    void submit(function<void()> task) {
+        Queue& queue = *queues[worker_index];
+        {
+            lock_guard<mutex> guard(queue.lock);
+            queue.tasks.push_back(std::move(task));
+        }
+        queued++;
+        wake.notify_one();
+    }
+
+    // Runs one task from this worker's deque or, failing that, one stolen from another worker
+    bool run_one() {
+        function<void()> task;
+        for (size_t i = 0; i < queues.size() && !task; ++i) {
+            Queue& queue = *queues[(worker_index + i) % queues.size()];
+            lock_guard<mutex> guard(queue.lock);
+            if (!queue.tasks.empty()) {
+                if (i == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+            }
+        }
+
+        if (!task) {
+            return false;
+        }
+        queued--;
+        task();
+        return true;
+    }
+};
+
+// Shared state of a node whose younger brothers are searched in parallel
+struct SplitPoint {
+    mutex lock;
+    int alpha;
+    int best_score;
+    int best_move;
+    atomic<int> pending{0};
+    atomic<bool> cutoff{false};
+};
+
+int parallel_negamax(Board& gameboard, int player, int depth, int alpha, int beta, TranspositionTable& TT, WorkStealingPool& pool, int split_plies) {
+    if (split_plies == 0) {
+        return negamax(gameboard, player, depth, alpha, beta, TT); // Counts the node itself
+    }
+    searched_nodes++;
+    if (stop_search->load(memory_order_relaxed)) {
         return 0;
     }
-    
-    int best_score = -10000; // Initial best score
-    int score;
-    
-    for (int move : get_possible_moves(gameboard)) {
-        gameboard[move] = player;
-        score = -negamax(gameboard, -player, depth-1, -beta, -alpha, TT);
-        gameboard[move] = 0;
-                
-        if (score > best_score) {
-            best_score = score;
+
+    int alpha_org = alpha;
+
+    int symmetry;
+    uint64_t hash = gameboard.position_key(player, symmetry);
+
+    int value, hash_move;
+    if (resolve_node(gameboard, hash, symmetry, player, depth, alpha, beta, TT, value, hash_move)) {
+        return value;
+    }
+
+    uint32_t possible = get_possible_moves(gameboard);
+    if (resolve_threats(gameboard, player, depth, 0, possible, value)) {
+        return value;
+    }
+
+    // Young brothers wait: the eldest (best ordered) move is searched first, on this thread, to establish a bound
+    int moves[Game::cells];
+    int move_count = move_ordering<Game>.order(possible, hash_move, depth, player, moves);
+    int first_move = moves[0];
+
+    gameboard.make_move(first_move, player);
+    int best_score = -parallel_negamax(gameboard, -player, depth-1, -beta, -alpha, TT, pool, split_plies-1);
+    gameboard.unmake_move(first_move, player);
+
+    int best_move = first_move;
+    alpha = max(alpha, best_score);
+
+    if (alpha >= beta) {
+        move_ordering<Game>.record_cutoff(first_move, 0, depth, player);
+    } else if (move_count > 1) {
+        SplitPoint split;
+        split.alpha = alpha;
+        split.best_score = best_score;
+        split.best_move = best_move;
+
+        // Queued in reverse: this thread pops its own deque from the back, so it takes the next best move,
+        // while idle threads steal from the front
+        for (int i = move_count - 1; i > 0; --i) {
+            int move = moves[i];
+            split.pending++;
+            pool.submit([&split, &TT, &pool, gameboard, move, i, player, depth, beta, split_plies]() mutable {
+                if (!split.cutoff) {
+                    int alpha;
+                    {
+                        lock_guard<mutex> guard(split.lock);
+                        alpha = split.alpha;
+                    }
+
+                    gameboard.make_move(move, player);
+                    int score = -parallel_negamax(gameboard, -player, depth-1, -beta, -alpha, TT, pool, split_plies-1);
+
+                    lock_guard<mutex> guard(split.lock);
+                    if (score > split.best_score) {
+                        split.best_score = score;
+                        split.best_move = move;
+                    }
+                    split.alpha = max(split.alpha, score);
+                    if (split.alpha >= beta && !split.cutoff) {
+                        split.cutoff = true; // Brothers that have not started yet are skipped
+                        move_ordering<Game>.record_cutoff(move, i, depth, player);
+                    }
+                }
+                split.pending--;
+            });
         }
-        
-        alpha = max(alpha, score);
-        
-        if (alpha >= beta) {
-            break;
+
+        // Help with any queued work until every brother has finished
+        while (split.pending > 0) {
+            if (!pool.run_one()) {
+                this_thread::yield();
+            }
         }
+
+        best_score = split.best_score;
+        best_move = split.best_move;
     }
-    
-    store(TT, board_str, alpha_org, beta, best_score, depth);
-    
+
+    if (stop_search->load(memory_order_relaxed)) {
+        return 0; // Interrupted, see negamax
+    }
+
+    store(TT, hash, alpha_org, beta, best_score, depth, Game::symmetry_maps[symmetry][best_move]);
+
     return best_score;
 }
 
-tuple<int, int> solve(vector<int> gameboard, int player, int depth) {
+// Root split for the parallel solver. The first move is searched alone, then the others run as pool tasks with
+// alpha lowered by one, so a move that ties the best score still gets an exact value and the lowest index wins,
+// matching the serial loop in solve().
+tuple<int, int> parallel_solve(Board gameboard, int player, int depth, TranspositionTable& TT) {
+    WorkStealingPool pool(search_threads);
+    array<int, Game::cells> scores;
+    scores.fill(-10000);
+
+    uint32_t moves = get_possible_moves(gameboard);
+    int first_move = __builtin_ctz(moves);
+    moves &= moves - 1;
+
+    gameboard.make_move(first_move, player);
+    scores[first_move] = -parallel_negamax(gameboard, -player, depth-1, -10000, 10000, TT, pool, split_plies);
+    gameboard.unmake_move(first_move, player);
+
+    SplitPoint split;
+    split.alpha = scores[first_move];
+
+    for (; moves; moves &= moves - 1) {
+        int move = __builtin_ctz(moves);
+        split.pending++;
+        pool.submit([&split, &scores, &TT, &pool, gameboard, move, player, depth]() mutable {
+            int alpha;
+            {
+                lock_guard<mutex> guard(split.lock);
+                alpha = split.alpha;
+            }
+
+            gameboard.make_move(move, player);
+            int score = -parallel_negamax(gameboard, -player, depth-1, -10000, -(alpha - 1), TT, pool, split_plies);
+            scores[move] = score;
+
+            {
+                lock_guard<mutex> guard(split.lock);
+                split.alpha = max(split.alpha, score);
+            }
+            split.pending--;
+        });
+    }
+
+    while (split.pending > 0) {
+        if (!pool.run_one()) {
+            this_thread::yield();
+        }
+    }
+
+    int best_move = first_move;
+    for (int move = 0; move < Game::cells; ++move) {
+        if (scores[move] > scores[best_move]) {
+            best_move = move;
+        }
+    }
+
+    return make_tuple(best_move, scores[best_move]);
+}
+
+// table is the game's own table when given, kept from move to move; otherwise the --cache file or a fresh table
+tuple<int, int> solve(Board gameboard, int player, int depth, TranspositionTable* table = nullptr) {
+    SearchStatsScope stats_scope;
     int best_move, score;
     int best_score = -10000; // Initial best score
-    int alpha = -10000; // Initial alpha value
-    int beta = 10000;   // Initial beta value
-    
-    map<string, vector<int>> TT;
-    
-    for (int move : get_possible_moves(gameboard)) {
-        gameboard[move] = player;
-        score = -negamax(gameboard, -player, depth-1, -beta, -alpha, TT);
-        gameboard[move] = 0;
-                
-        if (score > best_score) {
-            best_score = score;
-            best_move = move;
+
+    // Every child is a tablebase lookup when one is loaded
+    if (tablebase.loaded()) {
+        for (uint32_t moves = get_possible_moves(gameboard); moves; moves &= moves - 1) {
+            int move = __builtin_ctz(moves);
+
+            gameboard.make_move(move, player);
+            bool found = tablebase.probe(gameboard, -player, depth-1, score);
+            gameboard.unmake_move(move, player);
+
+            if (!found) {
+                best_score = -10000; // Not a position the tablebase covers, search instead
+                break;
+            }
+            if (-score > best_score) {
+                best_score = -score;
+                best_move = move;
+            }
+        }
+
+        if (best_score != -10000) {
+            return make_tuple(best_move, best_score);
         }
-        
-        alpha = max(alpha, score);
     }
-    
-    return make_tuple(best_move, best_score);
+
+    unique_ptr<TranspositionTable> local_table;
+    TranspositionTable& TT = select_table(table, cache_table.get(), local_table, tt_size_mb);
+    TT.new_search(); // Entries from earlier moves are replaced first
+    move_ordering<Game>.new_search();
+
+    if (search_threads > 1) {
+        return parallel_solve(gameboard, player, depth, TT);
+    }
+
+    return search_root(gameboard, player, depth, TT);
+}
+
+// Batch mode: each position solved to the end, see analyse_batch_line
+string analyse_line(const string& line) {
+    return analyse_batch_line<Game>(line, solve_depth<Game>, tt_size_mb, cache_table.get(), solve);
+}
+
+// Parallel scaling: time for a full solve from the empty board per thread count, checked against the serial result
+void benchmark_threads() {
+    Board gameboard;
+
+    cout << "threads\tms\tmove\tscore" << endl;
+    tuple<int, int> serial_result;
+    for (int threads : {1, 2, 4, 8, 16}) {
+        search_threads = threads;
+
+        auto start_time = chrono::high_resolution_clock::now();
+        tuple<int, int> result = solve(gameboard, -1, solve_depth(gameboard));
+        auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start_time);
+
+        if (threads == 1) {
+            serial_result = result;
+        }
+        cout << threads << "\t" << duration.count() << "\t" << get<0>(result) << "\t" << get<1>(result) << (result == serial_result ? "" : "\tMISMATCH") << endl;
+    }
+}
+
+// Fixed corpus for --bench: the empty board and evenly spaced samples of the dictionary's positions after 2, 3 and 4
+// moves, each solved to the end on one thread without the book or the tablebase
+void benchmark_corpus(int warmup, int reps) {
+    const int samples_per_count = 4;
+    vector<string> boards = {"0000000000000000"};
+
+    ifstream dictionary("4x4_dict.txt");
+    if (!dictionary) {
+        cerr << "Unable to open 4x4_dict.txt, benchmarking the empty board only." << endl;
+    }
+    vector<string> by_pieces[Game::cells + 1];
+    string line;
+    while (getline(dictionary, line)) {
+        string board_str;
+        istringstream(line) >> board_str;
+        Board gameboard;
+        if (parse_board(board_str, gameboard)) {
+            by_pieces[__builtin_popcount(gameboard.bits[0] | gameboard.bits[1])].push_back(board_str);
+        }
+    }
+    for (int pieces : {2, 3, 4}) {
+        const vector<string>& samples = by_pieces[pieces];
+        for (size_t i = 0; i < samples_per_count && i < samples.size(); ++i) {
+            boards.push_back(samples[i * samples.size() / samples_per_count]);
+        }
+    }
+
+    search_threads = 1;
+    TranspositionTable bench_table(tt_size_mb);
+    vector<BenchmarkCase> cases;
+    for (const string& board_str : boards) {
+        Board gameboard;
+        parse_board(board_str, gameboard);
+        int player = player_to_move(gameboard);
+        cases.push_back({board_str, [&] {
+            bench_table.clear();
+            move_ordering<Game>.clear();
+        }, [&bench_table, gameboard, player] {
+            return solve(gameboard, player, solve_depth(gameboard), &bench_table);
+        }});
+    }
+    run_benchmark("4x4", cases, warmup, reps, cout);
 }
 
-int main() {
-    vector<int> gameboard(16, 0);
+// Pondering: while the human thinks, the position after each of their replies is solved into the game's table on a
+// thread of its own, so that the AI's answer is mostly table lookups. Replies the opening book answers are skipped.
+// Cancelling stops the solve under way (its search polls cancelled) and waits for the thread. Off with --no-ponder.
+bool ponder_enabled = true;
+
+struct Ponder {
+    thread worker;
+    atomic<bool> cancelled{false};
+
+    // book is the opening book while it still covers the AI's next move, otherwise null
+    void start(const Board& gameboard, TranspositionTable* table, const OpeningBook* book) {
+        if (!ponder_enabled || tablebase.loaded()) {
+            return; // Nothing to gain over lookups
+        }
+
+        cancelled = false;
+        worker = thread([this, gameboard, table, book] {
+            stop_search = &cancelled;
+            for (uint32_t moves = get_possible_moves(gameboard); moves && !cancelled; moves &= moves - 1) {
+                Board position = gameboard;
+                position.make_move(__builtin_ctz(moves), 1);
+                int move, score;
+                if (!check_win(position, 1) && position.empty_cells() != 0 && !(book && book->lookup(position, move, score))) {
+                    solve(position, -1, solve_depth(position), table);
+                }
+            }
+        });
+    }
+
+    void finish() {
+        if (worker.joinable()) {
+            cancelled = true;
+            worker.join();
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    string batch_path;
+    string stats_path;
+    string cache_path;
+    bool bench = false;
+    int bench_reps = 5, bench_warmup = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--convert-book" && i + 2 < argc) {
+            convert_dictionary(argv[i + 1], argv[i + 2]); // e.g. ./4x4 --convert-book 4x4_dict.txt 4x4_book.bin
+            return 0;
+        } else if (arg == "--bench-check-win") {
+            benchmark_check_win<Game>();
+            return 0;
+        } else if (arg == "--build-tablebase" && i + 1 < argc) {
+            build_tablebase(argv[i + 1]); // e.g. ./4x4 --build-tablebase 4x4_tablebase.bin
+            return 0;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            search_threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--hash" && i + 1 < argc) {
+            tt_size_mb = max(1, atoi(argv[++i]));
+        } else if (arg == "--bench-threads") {
+            benchmark_threads();
+            return 0;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch_path = argv[++i]; // "-" reads standard input
+        } else if (arg == "--no-ponder") {
+            ponder_enabled = false;
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_path = argv[++i]; // One line of JSON per AI move, "-" for standard output
+        } else if (arg == "--perft" && i + 1 < argc) {
+            Board start;
+            return run_perft(atoi(argv[++i]), perft_totals, [&](int depth, uint64_t& ended) { return perft(start, 1, depth, ended); }) ? 0 : 1;
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--bench-reps" && i + 1 < argc) {
+            bench_reps = max(1, atoi(argv[++i]));
+        } else if (arg == "--bench-warmup" && i + 1 < argc) {
+            bench_warmup = max(0, atoi(argv[++i]));
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache_path = argv[++i]; // e.g. ./4x4 --cache 4x4_cache.bin
+        } else {
+            cerr << "Usage: " << argv[0] << " [--threads N] [--hash MB] [--batch FILE] [--cache FILE] [--stats FILE] [--no-ponder] [--bench] [--bench-reps N] [--bench-warmup N] [--bench-threads] [--bench-check-win] [--perft N] [--convert-book TEXT_FILE BOOK_FILE] [--build-tablebase FILE]" << endl;
+            return 1;
+        }
+    }
+
+    if (!cache_path.empty()) {
+        cache_table.reset(new TranspositionTable(tt_size_mb, cache_path, cache_tag));
+    }
+
+    if (bench) {
+        benchmark_corpus(bench_warmup, bench_reps);
+        return 0;
+    }
+
+    // Batch positions are spread over the threads, each solved serially (with the tablebase if there is one)
+    if (!batch_path.empty()) {
+        tablebase.load("4x4_tablebase.bin");
+        int batch_threads = search_threads;
+        search_threads = 1;
+        return run_batch_file(batch_path, batch_threads, analyse_line) ? 0 : 1;
+    }
+
+    Board gameboard;
     string input;
     int move, turn, score;
-    bool found;
     
     int moves_made = 0;
-    vector<tuple<string, int, int>> dictionary = load_dictionary();
+    // With the tablebase every move is a lookup, otherwise the opening book covers the first moves
+    OpeningBook book;
+    if (!tablebase.load("4x4_tablebase.bin") && !book.load("4x4_book.bin")) {
+        cerr << "Unable to load 4x4_book.bin, opening moves will be searched." << endl;
+    }
+
+    // Kept for the whole game (unless the --cache file is), so each search starts from what the last one found
+    unique_ptr<TranspositionTable> game_table;
+    if (!cache_table) {
+        game_table.reset(new TranspositionTable(tt_size_mb));
+    }
     
     cout << "Would you like to be player 1 or 2 (enter 'exit' to quit): ";
     while (true) {
@@ -208,39 +856,44 @@ int main() {
         }
     }
     
+    Ponder ponder;
     while (true) {
         display_board(gameboard);
         cout << endl;
         
         if (turn == 1) {
+            ponder.start(gameboard, game_table.get(), moves_made < 4 ? &book : nullptr);
             while (true) {
                 cout << "Enter move (1-16, or 'exit' to quit): ";
                 cin >> input;
                 transform(input.begin(), input.end(), input.begin(), ::tolower); // Make it lowercase for checks
 
                 if (input == "exit") {
+                    ponder.finish();
                     exit(0);
                 }
 
                 stringstream ss(input);
-                if (!(ss >> move) || move < 1 || move > 16 || gameboard[move - 1] != 0) {
+                if (!(ss >> move) || move < 1 || move > 16 || gameboard.at(move - 1) != 0) {
                     cout << "Invalid input. Please enter a number between 1 and 16 or 'exit'." << endl;
                     continue;
                 }
 
-                gameboard[move - 1] = 1;
+                gameboard.make_move(move - 1, 1);
                 moves_made++;
                 break;
             }
 
             // Check if the human player has won
             if (check_win(gameboard, 1)) {
+                ponder.finish();
                 display_board(gameboard);
                 cout << endl << "Human player wins!" << endl;
                 exit(0);
             }
 
-            if (find(gameboard.begin(), gameboard.end(), 0) == gameboard.end()) {
+            if (gameboard.empty_cells() == 0) {
+                ponder.finish();
                 display_board(gameboard);
                 cout << endl << "Game was a draw." << endl;
                 exit(0);
@@ -252,39 +905,24 @@ int main() {
             
             // Get the AI move
             auto start_time = chrono::high_resolution_clock::now(); // Start measuring time
-            
-            if (moves_made <= 4) {
-                string board_str;
-                for (int i : gameboard) {
-                    board_str += to_string(i);
-                }
+            ponder.finish(); // Part of the move's time: the search can't start until the pondering thread has stopped
 
-                found = false;
-                for (const auto& entry : dictionary) {
-                    if (get<0>(entry) == board_str) {
-                        move = get<1>(entry);
-                        score = get<2>(entry);
-                        found = true;
-                        break;
-                    }
-                }
-
-                if (!found) {
-                    cerr << "Error: Board state not found in dictionary." << endl;
-                    cout << board_str;
-                    exit(1);
-                }
-            } else {
-                tuple<int, int> result = solve(gameboard, -1, 16);
+            if (moves_made > 4 || !book.lookup(gameboard, move, score)) {
+                tuple<int, int> result = solve(gameboard, -1, solve_depth(gameboard), game_table.get());
                 move = get<0>(result);
                 score = get<1>(result);
+                if (!stats_path.empty()) {
+                    write_search_stats(stats_path); // Book moves have none
+                }
             }
             
-            gameboard[move] = -1;
+            gameboard.make_move(move, -1);
             moves_made++;
             auto end_time = chrono::high_resolution_clock::now();  // Stop measuring time
             auto duration = chrono::duration_cast<chrono::milliseconds>(end_time - start_time);
             cout << "AI evaluation: " << score << endl;
+            report_move_ordering<Game>();
+            report_table_hits();
             cout << "AI move took " << duration.count() << " milliseconds to calculate." << endl << endl; // Show time to calculate move
 
             if (check_win(gameboard, -1)) {
@@ -293,7 +931,7 @@ int main() {
                 exit(0);
             }
 
-            if (find(gameboard.begin(), gameboard.end(), 0) == gameboard.end()) {
+            if (gameboard.empty_cells() == 0) {
                 display_board(gameboard);
                 cout << endl << "Game was a draw." << endl;
                 exit(0);
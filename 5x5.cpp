@@ -5,127 +5,175 @@
 #include <algorithm>
 #include <chrono>
 #include <tuple>
-#include <map>
-#include <list>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include "engine.h"
 
 using namespace std;
 
-const vector<vector<int>> win_conditions = {{0,6,12,18},{6,12,18,24},{4,8,12,16},{8,12,16,20},{9,13,17,21},{3,7,11,15},{1,7,13,19},{5,11,17,23},{0,5,10,15},{5,10,15,20},{1,6,11,16},{6,11,16,21},{2,7,12,17},{7,12,17,22},{3,8,13,18},{8,13,18,23},{4,9,14,19},{9,14,19,24},{0,1,2,3},{1,2,3,4},{5,6,7,8},{6,7,8,9},{10,11,12,13},{11,12,13,14},{15,16,17,18},{16,17,18,19},{20,21,22,23},{21,22,23,24}};
-static const array<int, 25> position_map = {0, 0, 0, 0, 0, 0, 3, 3, 3, 0, 0, 3, 7, 3, 0, 0, 3, 3, 3, 0, 0, 0, 0, 0, 0}; // Give a higher score to moves in the middle
+using Game = Geometry<5, 4, LineRules>;
 
-struct TTEntry {
-    int best_score;
-    int depth;
-    int flag;
+// The lines (indices into Game::win_masks) through each cell, at most 8 on this board
+struct CellLines {
+    int count[Game::cells];
+    int lines[Game::cells][8];
 };
 
-typedef map<string, pair<list<string>::iterator, TTEntry>> LRUCache;
-list<string> lru_list;
-LRUCache table;
-const int max_cache_size = 3000000; // Maximum transposition table size
-
-void display_board(const vector<int>& gameboard) {
-    for (int i = 0; i < 25; ++i) {
-        char symbol = (gameboard[i] == 1) ? 'O' : ((gameboard[i] == -1) ? 'X' : ' ');
-        cout << symbol;
-        if ((i + 1) % 5 == 0) {
-            cout << endl;
-            if (i < 24) {
-                cout << "-----------------" << endl;
+constexpr CellLines build_cell_lines() {
+    CellLines cell_lines = {};
+    for (int line = 0; line < Game::line_count; ++line) {
+        for (int cell = 0; cell < Game::cells; ++cell) {
+            if (Game::win_masks[line] >> cell & 1) {
+                cell_lines.lines[cell][cell_lines.count[cell]++] = line;
             }
-        } else {
-            cout << " | ";
         }
     }
+    return cell_lines;
 }
 
-bool check_win(const vector<int>& gameboard, const int& player) {
-    for (const auto& condition : win_conditions) {
-        if (gameboard[condition[0]] == player && gameboard[condition[1]] == player && gameboard[condition[2]] == player && gameboard[condition[3]] == player) {
-            return true;
-        }
-    }
+static constexpr CellLines cell_lines = build_cell_lines();
 
-    return false;
-}
+// Value of a line holding pieces of only one side, by how many it holds. A line with both sides in it is dead.
+// Cells in the middle are on more lines, so this also keeps the early game towards the centre. A completed line
+// ends the game, so its weight is never evaluated, but make_move still counts it.
+static const int line_weights[Game::line_length + 1] = {0, 1, 3, 9, 27};
 
-int evaluate(const vector<int>& gameboard, int player) {
-    int score = 0, index = 0;
+// Bitboard that keeps the evaluation up to date: pieces per side in each of the 28 lines, and the sum of the
+// line values for player 1, so a leaf costs nothing to evaluate
+struct Board : BitBoard<Game> {
+    int8_t line_pieces[2][Game::line_count] = {};
+    int score = 0;
 
-    for (int cell : gameboard) {
-        if (cell == player) {
-            score += position_map[index];
-        } else if (cell == -player) {
-            score -= position_map[index];
+    static int line_value(int own, int opponent) {
+        if (opponent == 0) {
+            return line_weights[own];
+        }
+        if (own == 0) {
+            return -line_weights[opponent];
         }
-        ++index;
+        return 0;
     }
 
-    return score;
-}
+    void make_move(int cell, int player) {
+        BitBoard<Game>::make_move(cell, player);
+        for (int i = 0; i < cell_lines.count[cell]; ++i) {
+            int line = cell_lines.lines[cell][i];
+            score -= line_value(line_pieces[0][line], line_pieces[1][line]);
+            line_pieces[side(player)][line]++;
+            score += line_value(line_pieces[0][line], line_pieces[1][line]);
+        }
+    }
 
-vector<int> get_possible_moves(const vector<int>& gameboard) {
-    vector<int> possible_moves;
-    for (int i = 0; i < 25; ++i) {
-        if (gameboard[i] == 0) {
-            possible_moves.push_back(i);
+    void unmake_move(int cell, int player) {
+        BitBoard<Game>::unmake_move(cell, player);
+        for (int i = 0; i < cell_lines.count[cell]; ++i) {
+            int line = cell_lines.lines[cell][i];
+            score -= line_value(line_pieces[0][line], line_pieces[1][line]);
+            line_pieces[side(player)][line]--;
+            score += line_value(line_pieces[0][line], line_pieces[1][line]);
         }
     }
-    return possible_moves;
-}
+};
 
-void store(LRUCache& table, string board, int alpha_org, int beta, int best_score, int depth) {
-    string flag;
-    if (best_score <= alpha_org) {
-        flag = "UPPERCASE";
-    } else if (best_score >= beta) {
-        flag = "LOWERCASE";
-    } else {
-        flag = "EXACT";
+size_t tt_size_mb = 256; // Transposition table size in megabytes (rounded down to a power of two), set with --hash MB
+
+// Perft from the empty board, {nodes, games ended on the last ply} per depth. No line can be made before ply 7, so
+// these are 25 * 24 * ... and check the move generation only; deeper counts are left unchecked.
+const vector<pair<uint64_t, uint64_t>> perft_totals = {
+    {25, 0}, {600, 0}, {13800, 0}, {303600, 0}, {6375600, 0}, {127512000, 0},
+};
+TranspositionTable table(0); // Sized to tt_size_mb in main() once the options are read
+
+int search_threads = max(1u, thread::hardware_concurrency()); // Threads used by solve() (Lazy SMP), set with --threads N
+// A solve() sets its stop_search flag once it finishes so its helper threads abandon their search. Every thread
+// points at the flag of the solve() it works for, so batch mode can run several solves at once.
+thread_local int completed_depth = 0; // Last depth fully searched by this thread's last solve()
+
+// Time management for one solve(). No new depth is started past the soft deadline (half the time or node budget,
+// as the next depth usually takes longer than all the ones before it). The hard deadline and the node budget stop the search
+// wherever it is: negamax polls them every 1024 nodes and the unfinished depth is thrown away, so a move never
+// takes much longer than its budget. Nothing is stopped before depth 1 is done, so there is always a move.
+chrono::milliseconds move_time(1000); // Budget of an AI move, set with --movetime MS
+uint64_t node_budget = 0;             // Nodes a solve() may search on its own thread, set with --nodes N (0 for no limit)
+
+// Lets the main thread steer a solve() that is pondering on another thread (see Ponder)
+struct PonderControl {
+    atomic<bool> pondering{true}; // The deadlines and node budget do not count while set
+    atomic<bool> cancelled{false}; // The human played something else: give up at once
+};
+
+struct TimeManager {
+    chrono::steady_clock::time_point start_time = chrono::steady_clock::now();
+    chrono::milliseconds soft_limit, hard_limit;
+    uint64_t node_limit;
+    uint64_t start_nodes = searched_nodes;
+    atomic<bool>* stop;
+    PonderControl* ponder;
+    bool armed = false; // Set once depth 1 is done
+
+    TimeManager(chrono::milliseconds budget, uint64_t node_limit, atomic<bool>* stop, PonderControl* ponder) : soft_limit(budget / 2), hard_limit(budget), node_limit(node_limit), stop(stop), ponder(ponder) {}
+
+    bool pondering() const {
+        return ponder && ponder->pondering.load(memory_order_relaxed);
     }
 
-    TTEntry entry = {best_score, depth, (flag == "EXACT" ? 0 : (flag == "LOWERCASE" ? -1 : 1))};
+    bool cancelled() const {
+        return ponder && ponder->cancelled.load(memory_order_relaxed);
+    }
+
+    chrono::milliseconds elapsed() const {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start_time);
+    }
 
-    if (table.size() >= max_cache_size) {
-        string to_evict = lru_list.back();
-        lru_list.pop_back();
-        table.erase(to_evict);
+    bool past_soft_deadline() const {
+        if (cancelled()) {
+            return true;
+        }
+        return !pondering() && (elapsed() >= soft_limit || (node_limit > 0 && searched_nodes - start_nodes >= node_limit / 2));
     }
 
-    lru_list.push_front(board);
-    table[board] = make_pair(lru_list.begin(), entry);
+    void poll() {
+        if (cancelled() || (armed && !pondering() && (elapsed() >= hard_limit || (node_limit > 0 && searched_nodes - start_nodes >= node_limit)))) {
+            stop->store(true, memory_order_relaxed);
+        }
+    }
+};
+thread_local TimeManager* time_manager = nullptr; // Only the thread running solve() has one
+bool show_pv = false; // Print the score and principal variation of every iteration (--pv)
+bool show_progress = true; // Print the depth being searched (off in batch mode)
+int search_depth = 0; // Fixed depth to search to (--depth N), 0 for iterative deepening within the time limit
+
+// Kept below the win scores (100 and up) so a heuristic score is never mistaken for a result
+int evaluate(const Board& gameboard, int player) {
+    int score = player == 1 ? gameboard.score : -gameboard.score;
+    return max(-99, min(99, score));
 }
 
-int negamax(vector<int> gameboard, int player, int depth, int alpha, int beta, LRUCache& TT) {
+int negamax(Board& gameboard, int player, int depth, int alpha, int beta, TranspositionTable& TT) {
     int alpha_org = alpha;
+    searched_nodes++;
 
-    // Transposition table lookup
-    string board_str;
-    for (int i : gameboard) {
-        board_str += to_string(i);
+    if ((searched_nodes & 1023) == 0 && time_manager) {
+        time_manager->poll();
+    }
+    if (stop_search->load(memory_order_relaxed)) {
+        return 0;
     }
 
-    if (TT.find(board_str) != TT.end()) {
-        // Get TT data
-        TTEntry tt_entry = TT[board_str].second;
-        int tt_value = tt_entry.best_score;
-        int tt_depth = tt_entry.depth;
-        int tt_flag = tt_entry.flag;
-
-        if (tt_depth >= depth) {
+    PrincipalVariation<Game>& pv = principal_variation<Game>;
+    int pv_move = pv.enter(depth);
 
-            if (tt_flag == 0) {
-                return tt_value;
-            } else if (tt_flag == -1) {
-                alpha = max(alpha, tt_value);
-            } else if (tt_flag == 1) {
-                beta = min(beta, tt_value);
-            }
+    // Transposition table lookup (keyed on the canonical position and the side to move)
+    int symmetry;
+    uint64_t hash = gameboard.position_key(player, symmetry);
 
-            if (alpha >= beta) {
-                return tt_value;
-            }
-        }
+    int value, hash_move;
+    if (probe_table<Game>(hash, symmetry, depth, alpha, beta, TT, value, hash_move)) {
+        return value;
     }
 
     // Terminal node checks
@@ -137,7 +185,7 @@ int negamax(vector<int> gameboard, int player, int depth, int alpha, int beta, L
         return -100-depth;
     }
 
-    if (find(gameboard.begin(), gameboard.end(), 0) == gameboard.end()) {
+    if (gameboard.empty_cells() == 0) {
         return 0;
     }
 
@@ -145,82 +193,637 @@ int negamax(vector<int> gameboard, int player, int depth, int alpha, int beta, L
         return evaluate(gameboard, player);
     }
 
+    uint32_t possible = get_possible_moves(gameboard);
+    if (resolve_threats(gameboard, player, depth, 100, possible, value)) {
+        return value;
+    }
+
     int best_score = -10000; // Initial best score
+    int best_move = 0;
     int score;
 
-    for (int move : get_possible_moves(gameboard)) {
-        gameboard[move] = player;
+    MoveOrdering<Game>& ordering = move_ordering<Game>;
+    int moves[Game::cells];
+    int move_count = ordering.order(possible, pv_move >= 0 ? pv_move : hash_move, depth, player, moves);
+
+    for (int i = 0; i < move_count; ++i) {
+        int move = moves[i];
 
-        // Use a null window search by calling negamax with a narrow window
-        score = -negamax(gameboard, -player, depth-1, -alpha-1, -alpha, TT);
+        gameboard.make_move(move, player);
 
-        // If the score is inside the new window, re-evaluate with a proper window
-        if (alpha < score && score < beta) {
-            score = -negamax(gameboard, -player, depth-1, -beta, -score, TT);
+        if (i == 0) {
+            // Principal variation search: the first move is expected to be best and gets the full window
+            score = -negamax(gameboard, -player, depth-1, -beta, -alpha, TT);
+            pv.following = false;
+        } else {
+            // The rest only have to be shown worse, with a null window
+            score = -negamax(gameboard, -player, depth-1, -alpha-1, -alpha, TT);
+
+            // If the score is inside the new window, re-evaluate with a proper window
+            if (alpha < score && score < beta) {
+                score = -negamax(gameboard, -player, depth-1, -beta, -score, TT);
+            }
         }
 
-        gameboard[move] = 0;
+        gameboard.unmake_move(move, player);
 
         if (score > best_score) {
             best_score = score;
+            best_move = move;
         }
 
+        if (score > alpha) {
+            pv.update(depth, move);
+        }
         alpha = max(alpha, score);
 
         if (alpha >= beta) {
+            ordering.record_cutoff(move, i, depth, player);
             break;
         }
     }
 
-    store(TT, board_str, alpha_org, beta, best_score, depth);
+    // An interrupted search returns garbage, so keep it out of the table
+    if (stop_search->load(memory_order_relaxed)) {
+        return 0;
+    }
+
+    store(TT, hash, alpha_org, beta, best_score, depth, Game::symmetry_maps[symmetry][best_move]);
 
     return best_score;
 }
 
-tuple<int, int> solve(vector<int> gameboard, int player, int max_depth) {
-    int score, best_move, best_score, alpha, beta;
+// Lazy SMP helper: searches the same root as solve() and only shares results through the transposition table.
+// Odd helpers run a ply ahead and every helper starts its root moves at a different cell so the threads diverge.
+void helper_search(Board gameboard, int player, int max_depth, int id, atomic<bool>* stop) {
+    stop_search = stop;
+    for (int depth = 1 + id % 2; depth <= max_depth && !stop->load(); depth++) {
+        int alpha = -10000;
+        int beta = 10000;
+        uint32_t moves = get_possible_moves(gameboard);
+
+        for (int i = 0; i < Game::cells && !stop->load(); ++i) {
+            int move = (i + id * 7) % Game::cells;
+            if (!(moves >> move & 1)) {
+                continue;
+            }
 
-    LRUCache TT;
+            gameboard.make_move(move, player);
+            int score = -negamax(gameboard, -player, depth - 1, -beta, -alpha, table);
+            gameboard.unmake_move(move, player);
 
-    auto start_time = chrono::high_resolution_clock::now();
-    auto end_time = chrono::high_resolution_clock::now();
-    auto max_duration = chrono::milliseconds(1000); // Maximum search time (adjust as needed)
+            alpha = max(alpha, score);
+        }
+    }
+}
 
-    for (int depth = 1; depth <= max_depth; depth++) {
-        best_score = -10000; // Reset best_score for this depth
-        alpha = -10000; // Reset alpha value
-        beta = 10000; // Reset beta value
-
-        for (int move : get_possible_moves(gameboard)) {
-            gameboard[move] = player;
-            score = -negamax(gameboard, -player, depth - 1, -beta, -alpha, TT);
-            gameboard[move] = 0;
-
-            if (score > best_score) {
-                best_score = score;
-                best_move = move;
+// One pass over the root moves with the window (alpha, beta), trying the previous best move first, searched like
+// any other node with principal variation search.
+// Fail-soft: the result is above beta on a cutoff and at most alpha if every move failed low, in which case pass_move means nothing.
+int search_root_window(Board& gameboard, int player, int depth, int alpha, int beta, int first_move, int& pass_move) {
+    int best_score = -10000;
+    uint32_t moves = get_possible_moves(gameboard);
+
+    int order[Game::cells];
+    int move_count = 0;
+    if (first_move >= 0 && (moves >> first_move & 1)) {
+        order[move_count++] = first_move;
+        moves &= ~(1u << first_move);
+    }
+    for (; moves; moves &= moves - 1) {
+        order[move_count++] = __builtin_ctz(moves);
+    }
+
+    PrincipalVariation<Game>& pv = principal_variation<Game>;
+    pv.start_pass(depth);
+
+    for (int i = 0; i < move_count; ++i) {
+        int move = order[i];
+
+        gameboard.make_move(move, player);
+        int score;
+        if (i == 0) {
+            score = -negamax(gameboard, -player, depth - 1, -beta, -alpha, table);
+            pv.following = false;
+        } else {
+            score = -negamax(gameboard, -player, depth - 1, -alpha - 1, -alpha, table);
+            if (alpha < score && score < beta) {
+                score = -negamax(gameboard, -player, depth - 1, -beta, -score, table);
             }
+        }
+        gameboard.unmake_move(move, player);
 
-            alpha = max(alpha, score);
+        if (score > best_score) {
+            best_score = score;
+            pass_move = move;
+        }
+
+        if (score > alpha) {
+            pv.update(depth, move);
+        }
+        alpha = max(alpha, score);
+        if (alpha >= beta) {
+            break;
+        }
+    }
+
+    return best_score;
+}
+
+// Root drivers for each iteration of solve(). AUTO picks one per position from the previous iterations' scores.
+enum RootDriver { DRIVER_AUTO, DRIVER_FULL_WINDOW, DRIVER_ASPIRATION, DRIVER_MTDF };
+RootDriver root_driver = DRIVER_AUTO; // Set with --driver
+const int aspiration_window = 16; // Half width of the first aspiration window, about what one move shifts the evaluation by
+thread_local int root_re_searches = 0; // Aspiration re-searches and extra MTD(f) passes during the last solve()
+
+// Search inside a window around guess, widening it on whichever side the score fell out of
+int aspiration_search(Board& gameboard, int player, int depth, int guess, int& best_move) {
+    int delta = aspiration_window;
+
+    while (true) {
+        int alpha = max(guess - delta, -10000);
+        int beta = min(guess + delta, 10000);
+
+        int move = best_move;
+        int score = search_root_window(gameboard, player, depth, alpha, beta, best_move, move);
+        if (stop_search->load(memory_order_relaxed)) {
+            return score;
+        }
+
+        if ((alpha < score && score < beta) || (alpha == -10000 && beta == 10000)) {
+            best_move = move;
+            principal_variation<Game>.keep();
+            return score;
+        }
+
+        root_re_searches++;
+        guess = score;
+        delta *= 4;
+    }
+}
+
+// MTD(f): zero window passes that close in on the score from the guess.
+// The move comes from the last pass that failed high, which is the first move found reaching the final score.
+int mtdf_search(Board& gameboard, int player, int depth, int guess, int& best_move) {
+    int lower = -10000;
+    int upper = 10000;
+    int score = guess;
+    bool first_pass = true;
+
+    while (lower < upper) {
+        int beta = score == lower ? score + 1 : score;
+
+        int move = best_move;
+        score = search_root_window(gameboard, player, depth, beta - 1, beta, best_move, move);
+        if (stop_search->load(memory_order_relaxed)) {
+            return score;
+        }
+
+        if (!first_pass) {
+            root_re_searches++;
+        }
+        first_pass = false;
+
+        if (score < beta) {
+            upper = score;
+        } else {
+            lower = score;
+            best_move = move;
+            principal_variation<Game>.keep();
+        }
+    }
+
+    return score;
+}
+
+// MTD(f) only pays off when the guess is already right, so it is used once the score has settled.
+// Wins and losses move by a point each depth, and aspiration copes with that better.
+RootDriver pick_root_driver(int depth, int previous_score, int score) {
+    if (root_driver != DRIVER_AUTO) {
+        return root_driver;
+    }
+    if (depth <= 2) {
+        return DRIVER_FULL_WINDOW;
+    }
+    if (previous_score == score && abs(score) < 100) {
+        return DRIVER_MTDF;
+    }
+    return DRIVER_ASPIRATION;
+}
+
+// The principal variation kept from the last pass, carried on with the table's best moves where it stops short.
+// The triangular table loses the line below a table cutoff, and MTD(f)'s zero window passes only record the
+// first move of each line, so the rest comes from the table.
+int principal_variation_line(Board gameboard, int player, int depth, int* line) {
+    const PrincipalVariation<Game>& pv = principal_variation<Game>;
+    int length = 0;
+
+    while (length < depth && !check_win(gameboard, 1) && !check_win(gameboard, -1)) {
+        int move = -1;
+        if (length < pv.previous_length) {
+            move = pv.previous[length];
+        } else {
+            int symmetry;
+            TTEntry tt_entry;
+            if (table.probe(gameboard.position_key(player, symmetry), tt_entry)) {
+                move = Game::inverse_symmetry_maps[symmetry][tt_entry.best_move];
+            }
         }
 
-        end_time = chrono::high_resolution_clock::now();
-        auto duration = chrono::duration_cast<chrono::milliseconds>(end_time - start_time);
+        if (move < 0 || gameboard.at(move) != 0) {
+            break;
+        }
+        line[length++] = move;
+        gameboard.make_move(move, player);
+        player = -player;
+    }
 
-        cout << "Searching at depth: " << to_string(depth) << "\r" << flush;
+    return length;
+}
+
+// Moves numbered 1-25 like the board input
+string format_line(const int* line, int length) {
+    string text;
+    for (int i = 0; i < length; ++i) {
+        text += (i > 0 ? " " : "") + to_string(line[i] + 1);
+    }
+    return text;
+}
+
+// Iterative deepening until max_depth, until max_duration (1 s by default) or the node budget runs out as described
+// at TimeManager, or until a depth proves a win or a loss. The move and score are always those of the last depth
+// that was searched to the end. A pondering search (ponder set) prints nothing.
+tuple<int, int> solve(Board gameboard, int player, int max_depth, chrono::milliseconds max_duration = chrono::milliseconds(1000), PonderControl* ponder = nullptr) {
+    int best_move = -1, best_score = 0, previous_score = 0;
+    SearchStatsScope stats_scope;
+
+    TranspositionTable& TT = table;
+    TT.new_search();
+    move_ordering<Game>.new_search();
+    principal_variation<Game>.clear();
+    root_re_searches = 0;
+
+    atomic<bool> stop(false);
+    stop_search = &stop;
+    TimeManager timer(max_duration, node_budget, &stop, ponder);
+    time_manager = &timer;
+    vector<thread> helpers;
+    HelperCounters helper_counters;
+    for (int id = 1; id < search_threads; ++id) {
+        helpers.emplace_back([&, gameboard, id] {
+            helper_search(gameboard, player, max_depth, id, &stop);
+            helper_counters.collect();
+        });
+    }
 
-        if (duration >= max_duration) {
-            break; // Exit the loop if the time limit is reached
+    int line[Game::cells];
+    int line_length = 0;
+    for (int depth = 1; depth <= max_depth; depth++) {
+        if (depth > 1 && timer.past_soft_deadline()) {
+            break;
+        }
+
+        int score;
+        int move = best_move;
+        switch (pick_root_driver(depth, previous_score, best_score)) {
+        case DRIVER_MTDF:
+            score = mtdf_search(gameboard, player, depth, best_score, move);
+            break;
+        case DRIVER_ASPIRATION:
+            score = aspiration_search(gameboard, player, depth, best_score, move);
+            break;
+        default:
+            score = search_root_window(gameboard, player, depth, -10000, 10000, best_move, move);
+            principal_variation<Game>.keep();
+            break;
+        }
+
+        // Stopped part way: the unfinished depth's move and line are not to be trusted
+        if (stop.load(memory_order_relaxed)) {
+            principal_variation<Game>.keep(line, line_length);
+            break;
+        }
+        best_move = move;
+
+        // Follow the whole line next iteration, including the part only the table knows
+        line_length = principal_variation_line(gameboard, player, depth, line);
+        principal_variation<Game>.keep(line, line_length);
+
+        previous_score = best_score;
+        best_score = score;
+
+        completed_depth = depth;
+        timer.armed = true;
+        ENGINE_STAT(search_stats.add_iteration(depth));
+
+        if (show_pv && !ponder) {
+            cout << "depth " << depth << " score " << score << " pv " << format_line(line, line_length) << endl;
+        } else if (show_progress && !ponder) {
+            cout << "Searching at depth: " << to_string(depth) << "\r" << flush;
+        }
+
+        // A win or loss found at this depth is certain, searching deeper only repeats it
+        if (abs(score) >= 100) {
+            break;
         }
     }
 
+    stop = true;
+    for (thread& helper : helpers) {
+        helper.join();
+    }
+    helper_counters.merge();
+    stop_search = &never_stop;
+    time_manager = nullptr;
+
     return make_tuple(best_move, best_score);
 }
 
-int main() {
-    vector<int> gameboard(25, 0);
+// solve() to --depth if one was given, otherwise within --movetime (1 s by default)
+tuple<int, int> solve_position(const Board& gameboard, int player, PonderControl* ponder = nullptr) {
+    if (search_depth > 0) {
+        return solve(gameboard, player, search_depth, chrono::milliseconds::max(), ponder);
+    }
+    return solve(gameboard, player, 25, move_time, ponder);
+}
+
+// Batch mode: the first field of the line is the board (as in 4x4_dict.txt), the rest is ignored
+string analyse_line(const string& line) {
+    string board_str;
+    istringstream(line) >> board_str;
+
+    Board gameboard;
+    if (!parse_board(board_str, gameboard)) {
+        cerr << "Skipping invalid board: " << line << endl;
+        return "";
+    }
+    int player = player_to_move(gameboard);
+
+    return batch_line(board_str, [&] {
+        int score;
+        if (game_over_score(gameboard, player, __builtin_popcount(gameboard.empty_cells()), 100, score)) {
+            return make_tuple(-1, score);
+        }
+        return solve_position(gameboard, player);
+    });
+}
+
+// Lazy SMP scaling: depth reached in the normal 1 s budget and time to finish a fixed depth, per thread count
+void benchmark_threads() {
+    const int fixed_depth = 9;
+    Board gameboard;
+    gameboard.make_move(12, 1);
+
+    cout << "threads\tdepth_in_1s\tms_to_depth_" << fixed_depth << endl;
+    for (int threads : {1, 2, 4, 8, 16}) {
+        search_threads = threads;
+
+        table.clear();
+        solve(gameboard, -1, 25);
+        int depth_reached = completed_depth;
+
+        table.clear();
+        auto start_time = chrono::high_resolution_clock::now();
+        solve(gameboard, -1, fixed_depth, chrono::milliseconds::max());
+        auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start_time);
+
+        cout << threads << "\t" << depth_reached << "\t\t" << duration.count() << "                    " << endl; // Trailing spaces cover up printed depth
+    }
+}
+
+// Root drivers compared on one thread: depth reached in 1 s, time to finish a fixed depth and the re-searches it took
+void benchmark_drivers() {
+    const int fixed_depth = 10;
+    const vector<vector<int>> openings = {{12}, {12, 6, 18}, {6, 12, 7, 8, 17}};
+    const pair<RootDriver, const char*> drivers[] = {{DRIVER_FULL_WINDOW, "full"}, {DRIVER_ASPIRATION, "aspiration"}, {DRIVER_MTDF, "mtdf"}, {DRIVER_AUTO, "auto"}};
+    search_threads = 1;
+
+    cout << "driver\tposition\tdepth_in_1s\tms_to_depth_" << fixed_depth << "\tre_searches" << endl;
+    for (auto& [driver, name] : drivers) {
+        root_driver = driver;
+
+        for (size_t p = 0; p < openings.size(); ++p) {
+            Board gameboard;
+            int player = 1;
+            for (int move : openings[p]) {
+                gameboard.make_move(move, player);
+                player = -player;
+            }
+
+            table.clear();
+            move_ordering<Game>.clear();
+            solve(gameboard, player, 25);
+            int depth_reached = completed_depth;
+
+            table.clear();
+            move_ordering<Game>.clear();
+            auto start_time = chrono::high_resolution_clock::now();
+            solve(gameboard, player, fixed_depth, chrono::milliseconds::max());
+            auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start_time);
+
+            cout << name << "\t" << p << "\t\t" << depth_reached << "\t\t" << duration.count() << "\t\t" << root_re_searches << "                    " << endl;
+        }
+    }
+}
+
+// Fixed corpus for --bench, boards as in batch mode: the empty board, the centre opening and positions where one side
+// has a forced win within a few moves. Each is searched on one thread to --depth, 9 by default, so the timing does
+// not depend on the clock.
+void benchmark_corpus(int warmup, int reps) {
+    const vector<string> boards = {
+        "0000000000000000000000000",
+        "0000000000001000000000000",
+        "00000000-1-100000010001-1101",
+        "100-1-1000100-1-1000100100001",
+        "00100000-10001-100100-11-1010",
+        "000-10-1010-1001110000000000",
+        "001101-1-1101001-10000-10-1000",
+    };
+    int depth = search_depth > 0 ? search_depth : 9;
+    search_threads = 1;
+    show_pv = show_progress = false;
+
+    vector<BenchmarkCase> cases;
+    for (const string& board_str : boards) {
+        Board gameboard;
+        parse_board(board_str, gameboard);
+        int player = player_to_move(gameboard);
+        cases.push_back({board_str, [] {
+            table.clear();
+            move_ordering<Game>.clear();
+        }, [gameboard, player, depth] {
+            return solve(gameboard, player, min(depth, __builtin_popcount(gameboard.empty_cells())), chrono::milliseconds::max());
+        }});
+    }
+    run_benchmark("5x5", cases, warmup, reps, cout);
+}
+
+// Pondering: while the human thinks, the position after the reply the principal variation expects is searched on a
+// thread of its own. If the human plays that reply, the search becomes the AI's move with the time it has had counted
+// against the budget, so the answer is often immediate; otherwise it is cancelled and the AI searches as usual,
+// with whatever the pondering left in the table. Off with --no-ponder.
+bool ponder_enabled = true;
+
+struct Ponder {
+    thread worker;
+    PonderControl control;
+    int expected_reply = -1;
+
+    // The pondering thread's result and thread-local search state, taken over by the main thread on a hit
+    tuple<int, int> result;
+    PrincipalVariation<Game> pv;
+    MoveOrdering<Game> ordering;
+    SearchStats stats;
+    int re_searches = 0;
+
+    // Ponders on the AI's behalf if the last AI search expects a reply (the second move of its principal variation)
+    void start(const Board& gameboard) {
+        const PrincipalVariation<Game>& line = principal_variation<Game>;
+        if (!ponder_enabled || line.previous_length < 2 || gameboard.at(line.previous[1]) != 0) {
+            return;
+        }
+
+        Board position = gameboard;
+        expected_reply = line.previous[1];
+        position.make_move(expected_reply, 1);
+        if (check_win(position, 1) || position.empty_cells() == 0) {
+            return;
+        }
+
+        control.pondering = true;
+        control.cancelled = false;
+        worker = thread([this, position] {
+            result = solve_position(position, -1, &control);
+            pv = principal_variation<Game>;
+            ordering = move_ordering<Game>;
+            stats = search_stats;
+            re_searches = root_re_searches;
+        });
+    }
+
+    // The human played move. On a hit the pondering search is left to finish within the move's budget and true is
+    // returned with its result (its principal variation, ordering statistics and search stats now this thread's).
+    bool finish(int move, tuple<int, int>& answer) {
+        if (!worker.joinable()) {
+            return false;
+        }
+
+        bool hit = move == expected_reply;
+        if (hit) {
+            control.pondering = false;
+        } else {
+            control.cancelled = true;
+        }
+        worker.join();
+        if (!hit) {
+            return false;
+        }
+
+        principal_variation<Game> = pv;
+        move_ordering<Game> = ordering;
+        search_stats = stats;
+        root_re_searches = re_searches;
+        answer = result;
+        return true;
+    }
+
+    void cancel() {
+        finish(-1, result);
+    }
+};
+
+void print_usage(const char* program) {
+    cerr << "Usage: " << program << " [--threads N] [--hash MB] [--depth N] [--movetime MS] [--nodes N] [--no-ponder] [--batch FILE] [--driver auto|full|aspiration|mtdf] [--pv] [--stats FILE] [--bench] [--bench-reps N] [--bench-warmup N] [--bench-threads] [--bench-drivers] [--bench-check-win] [--perft N]" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    Board gameboard;
     string input;
     int move, turn, score;
+    string batch_path;
+    string stats_path;
+    bool bench = false, bench_threads = false, bench_drivers = false;
+    int bench_reps = 5, bench_warmup = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            search_threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--hash" && i + 1 < argc) {
+            tt_size_mb = max(1, atoi(argv[++i]));
+        } else if (arg == "--bench-threads") {
+            bench_threads = true;
+        } else if (arg == "--driver" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name == "full") {
+                root_driver = DRIVER_FULL_WINDOW;
+            } else if (name == "aspiration") {
+                root_driver = DRIVER_ASPIRATION;
+            } else if (name == "mtdf") {
+                root_driver = DRIVER_MTDF;
+            } else if (name == "auto") {
+                root_driver = DRIVER_AUTO;
+            } else {
+                cerr << "Unknown root driver: " << name << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--no-ponder") {
+            ponder_enabled = false;
+        } else if (arg == "--movetime" && i + 1 < argc) {
+            move_time = chrono::milliseconds(max(1, atoi(argv[++i])));
+        } else if (arg == "--nodes" && i + 1 < argc) {
+            node_budget = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--depth" && i + 1 < argc) {
+            search_depth = min(max(1, atoi(argv[++i])), Game::cells);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch_path = argv[++i]; // "-" reads standard input
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_path = argv[++i]; // One line of JSON per AI move, "-" for standard output
+        } else if (arg == "--perft" && i + 1 < argc) {
+            Board start;
+            return run_perft(atoi(argv[++i]), perft_totals, [&](int depth, uint64_t& ended) { return perft(start, 1, depth, ended); }) ? 0 : 1;
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--bench-reps" && i + 1 < argc) {
+            bench_reps = max(1, atoi(argv[++i]));
+        } else if (arg == "--bench-warmup" && i + 1 < argc) {
+            bench_warmup = max(0, atoi(argv[++i]));
+        } else if (arg == "--pv") {
+            show_pv = true;
+        } else if (arg == "--bench-check-win") {
+            benchmark_check_win<Game>();
+            return 0;
+        } else if (arg == "--bench-drivers") {
+            bench_drivers = true;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    table = TranspositionTable(tt_size_mb);
+
+    if (bench_threads) {
+        benchmark_threads();
+        return 0;
+    }
+    if (bench_drivers) {
+        benchmark_drivers();
+        return 0;
+    }
+    if (bench) {
+        benchmark_corpus(bench_warmup, bench_reps);
+        return 0;
+    }
+
+    // Batch positions are spread over the threads, each searched on one thread
+    if (!batch_path.empty()) {
+        int batch_threads = search_threads;
+        search_threads = 1;
+        show_pv = show_progress = false;
+        return run_batch_file(batch_path, batch_threads, analyse_line) ? 0 : 1;
+    }
 
     cout << "Would you like to be player 1 or 2 (enter 'exit' to quit): ";
     while (true) {
@@ -239,38 +842,46 @@ int main() {
         }
     }
 
+    Ponder ponder;
+    int human_move = -1;
     while (true) {
         display_board(gameboard);
         cout << endl;
 
         if (turn == 1) {
+            ponder.start(gameboard);
             while (true) {
                 cout << "Enter move (1-25, or 'exit' to quit): ";
                 cin >> input;
                 transform(input.begin(), input.end(), input.begin(), ::tolower); // Make it lowercase for checks
 
                 if (input == "exit") {
+                    ponder.cancel();
                     exit(0);
                 }
 
                 stringstream ss(input);
-                if (!(ss >> move) || move < 1 || move > 25 || gameboard[move - 1] != 0) {
+                if (!(ss >> move) || move < 1 || move > 25 || gameboard.at(move - 1) != 0) {
                     cout << "Invalid input. Please enter a number between 1 and 25 or 'exit'." << endl;
                     continue;
                 }
 
-                gameboard[move - 1] = 1;
+                gameboard.make_move(move - 1, 1);
+                human_move = move - 1;
                 break;
             }
 
             // Check if the human player has won
+            if (check_win(gameboard, 1) || gameboard.empty_cells() == 0) {
+                ponder.cancel();
+            }
             if (check_win(gameboard, 1)) {
                 display_board(gameboard);
                 cout << endl << "Human player wins!" << endl;
                 exit(0);
             }
 
-            if (find(gameboard.begin(), gameboard.end(), 0) == gameboard.end()) {
+            if (gameboard.empty_cells() == 0) {
                 display_board(gameboard);
                 cout << endl << "Game was a draw." << endl;
                 exit(0);
@@ -283,14 +894,24 @@ int main() {
             // Get the AI move
             auto start_time = chrono::high_resolution_clock::now(); // Start measuring time
 
-            tuple<int, int> result = solve(gameboard, -1, 25);
+            tuple<int, int> result;
+            if (!ponder.finish(human_move, result)) {
+                result = solve_position(gameboard, -1);
+            }
             move = get<0>(result);
             score = get<1>(result);
 
-            gameboard[move] = -1;
+            gameboard.make_move(move, -1);
             auto end_time = chrono::high_resolution_clock::now();  // Stop measuring time
             auto duration = chrono::duration_cast<chrono::milliseconds>(end_time - start_time);
             cout << "AI evaluation: " << score << "          " << endl; // Add white space to cover up printed depth
+            report_move_ordering<Game>();
+            cout << "Root re-searches: " << root_re_searches << endl;
+            const PrincipalVariation<Game>& pv = principal_variation<Game>;
+            cout << "Principal variation: " << format_line(pv.previous, pv.previous_length) << endl;
+            if (!stats_path.empty()) {
+                write_search_stats(stats_path);
+            }
             cout << "AI move took " << duration.count() << " milliseconds to calculate." << endl << endl; // Show time to calculate move
 
             if (check_win(gameboard, -1)) {
@@ -299,7 +920,7 @@ int main() {
                 exit(0);
             }
 
-            if (find(gameboard.begin(), gameboard.end(), 0) == gameboard.end()) {
+            if (gameboard.empty_cells() == 0) {
                 display_board(gameboard);
                 cout << endl << "Game was a draw." << endl;
                 exit(0);
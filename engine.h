@@ -0,0 +1,1519 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+// Engine shared by the solvers. A game is a Geometry: the board size, how many in a row win and a rule set.
+// Everything derived from it (win masks, symmetry maps, Zobrist keys, move order) is built at compile time, so
+// each solver is an instantiation for its exact board and the inner loops unroll to straight-line code.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define ENGINE_X86 1
+#include <immintrin.h>
+#endif
+
+// Rule sets
+struct LineRules { // Rows, columns and diagonals of the required length
+    static constexpr bool squares = false;
+    static constexpr int piece_limit = 0; // Pieces per player before the oldest is lifted (0 = no limit)
+};
+
+struct SquareRules { // 4x4 rules: lines, the four corners and every 2x2 square
+    static constexpr bool squares = true;
+    static constexpr int piece_limit = 0;
+};
+
+struct MoveableRules { // Lines, but each player has three pieces and moves the oldest one
+    static constexpr bool squares = false;
+    static constexpr int piece_limit = 3;
+};
+
+// Calls visit(mask) for every winning group of cells
+template <int N, int K, class Rules, class Visit>
+constexpr void for_each_win_mask(Visit visit) {
+    const int directions[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+    for (const auto& direction : directions) {
+        for (int row = 0; row < N; ++row) {
+            for (int col = 0; col < N; ++col) {
+                int end_row = row + (K - 1) * direction[0], end_col = col + (K - 1) * direction[1];
+                if (end_row < 0 || end_row >= N || end_col < 0 || end_col >= N) {
+                    continue;
+                }
+                uint32_t mask = 0;
+                for (int i = 0; i < K; ++i) {
+                    mask |= 1u << ((row + i * direction[0]) * N + col + i * direction[1]);
+                }
+                visit(mask);
+            }
+        }
+    }
+
+    if (Rules::squares) {
+        visit(1u << 0 | 1u << (N - 1) | 1u << (N * (N - 1)) | 1u << (N * N - 1));
+        for (int row = 0; row + 1 < N; ++row) {
+            for (int col = 0; col + 1 < N; ++col) {
+                visit(1u << (row * N + col) | 1u << (row * N + col + 1) | 1u << ((row + 1) * N + col) | 1u << ((row + 1) * N + col + 1));
+            }
+        }
+    }
+}
+
+template <int N, int K, class Rules>
+constexpr int count_win_masks() {
+    int count = 0;
+    for_each_win_mask<N, K, Rules>([&](uint32_t) { count++; });
+    return count;
+}
+
+template <int N, int K, class Rules, int Count>
+constexpr std::array<uint32_t, Count> build_win_masks() {
+    std::array<uint32_t, Count> masks = {};
+    int i = 0;
+    for_each_win_mask<N, K, Rules>([&](uint32_t mask) { masks[i++] = mask; });
+    return masks;
+}
+
+// Random keys for every (cell, player) pair, generated from a fixed seed so hashes are reproducible
+template <int Cells>
+constexpr std::array<std::array<uint64_t, 2>, Cells> build_zobrist_keys() {
+    std::array<std::array<uint64_t, 2>, Cells> keys = {};
+    uint64_t seed = 0;
+    for (auto& cell_keys : keys) {
+        for (uint64_t& key : cell_keys) {
+            // splitmix64
+            seed += 0x9E3779B97F4A7C15;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+            key = z ^ (z >> 31);
+        }
+    }
+    return keys;
+}
+
+// Cell permutations for the 8 symmetries of the square: 4 rotations, each optionally mirrored first
+template <int N>
+constexpr std::array<std::array<int, N * N>, 8> build_symmetry_maps() {
+    std::array<std::array<int, N * N>, 8> maps = {};
+    for (int symmetry = 0; symmetry < 8; ++symmetry) {
+        for (int cell = 0; cell < N * N; ++cell) {
+            int row = cell / N, col = cell % N;
+            if (symmetry >= 4) {
+                col = N - 1 - col;
+            }
+            for (int turn = 0; turn < symmetry % 4; ++turn) {
+                int old_row = row;
+                row = col;
+                col = N - 1 - old_row;
+            }
+            maps[symmetry][cell] = row * N + col;
+        }
+    }
+    return maps;
+}
+
+template <int N>
+constexpr std::array<std::array<int, N * N>, 8> build_inverse_symmetry_maps() {
+    std::array<std::array<int, N * N>, 8> maps = build_symmetry_maps<N>();
+    std::array<std::array<int, N * N>, 8> inverse = {};
+    for (int symmetry = 0; symmetry < 8; ++symmetry) {
+        for (int cell = 0; cell < N * N; ++cell) {
+            inverse[symmetry][maps[symmetry][cell]] = cell;
+        }
+    }
+    return inverse;
+}
+
+// Transformed bits for each byte of a bitboard, so a whole board is permuted with one lookup per byte
+template <int N>
+constexpr std::array<std::array<std::array<uint32_t, 256>, (N * N + 7) / 8>, 8> build_symmetry_lut() {
+    std::array<std::array<int, N * N>, 8> maps = build_symmetry_maps<N>();
+    std::array<std::array<std::array<uint32_t, 256>, (N * N + 7) / 8>, 8> lut = {};
+    for (int symmetry = 0; symmetry < 8; ++symmetry) {
+        for (int chunk = 0; chunk < (N * N + 7) / 8; ++chunk) {
+            for (int byte = 0; byte < 256; ++byte) {
+                for (int bit = 0; bit < 8 && chunk * 8 + bit < N * N; ++bit) {
+                    if (byte >> bit & 1) {
+                        lut[symmetry][chunk][byte] |= 1u << maps[symmetry][chunk * 8 + bit];
+                    }
+                }
+            }
+        }
+    }
+    return lut;
+}
+
+// Cells nearest the centre first (ties in index order)
+template <int N>
+constexpr std::array<int, N * N> build_center_order() {
+    std::array<int, N * N> order = {};
+    std::array<int, N * N> distance = {};
+    for (int cell = 0; cell < N * N; ++cell) {
+        int row = 2 * (cell / N) - (N - 1), col = 2 * (cell % N) - (N - 1);
+        order[cell] = cell;
+        distance[cell] = row * row + col * col;
+    }
+    for (int i = 1; i < N * N; ++i) {
+        for (int j = i; j > 0 && distance[order[j]] < distance[order[j - 1]]; --j) {
+            int swap = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = swap;
+        }
+    }
+    return order;
+}
+
+// An N x N board where K in a row (or whatever Rules adds) wins
+template <int N, int K, class Rules>
+struct Geometry {
+    static_assert(N * N <= 32, "a player's pieces must fit in a 32-bit bitboard");
+
+    using rules = Rules;
+    static constexpr int size = N;
+    static constexpr int cells = N * N;
+    static constexpr int line_length = K;
+    static constexpr uint32_t full_board = cells == 32 ? 0xFFFFFFFF : (1u << cells) - 1;
+    static constexpr int line_count = count_win_masks<N, K, Rules>();
+
+    static constexpr std::array<uint32_t, line_count> win_masks = build_win_masks<N, K, Rules, line_count>();
+    static constexpr std::array<std::array<uint64_t, 2>, cells> zobrist_keys = build_zobrist_keys<cells>();
+    static constexpr std::array<std::array<int, cells>, 8> symmetry_maps = build_symmetry_maps<N>();
+    static constexpr std::array<std::array<int, cells>, 8> inverse_symmetry_maps = build_inverse_symmetry_maps<N>();
+    static constexpr std::array<std::array<std::array<uint32_t, 256>, (cells + 7) / 8>, 8> symmetry_lut = build_symmetry_lut<N>();
+    static constexpr std::array<int, cells> center_order = build_center_order<N>();
+
+    // True if the pieces complete any win mask; unrolled into one AND-compare per mask with no branches
+    static constexpr bool has_line(uint32_t pieces) {
+        return has_line(pieces, std::make_index_sequence<line_count>{});
+    }
+
+    // Empty cells that would complete a win mask for the player owning pieces (their threats)
+    static constexpr uint32_t winning_cells(uint32_t pieces, uint32_t empty) {
+        return winning_cells(pieces, empty, std::make_index_sequence<line_count>{});
+    }
+
+    // Image of a bitboard under one of the 8 symmetries
+    static constexpr uint32_t transform(uint32_t bits, int symmetry) {
+        return transform(bits, symmetry, std::make_index_sequence<(cells + 7) / 8>{});
+    }
+
+private:
+    template <size_t... I>
+    static constexpr bool has_line(uint32_t pieces, std::index_sequence<I...>) {
+        return (((pieces & win_masks[I]) == win_masks[I]) | ...);
+    }
+
+    // The one cell the pieces are missing from mask, if it is empty
+    static constexpr uint32_t missing_cell(uint32_t pieces, uint32_t empty, uint32_t mask) {
+        uint32_t missing = mask & ~pieces;
+        return (missing & (missing - 1)) == 0 ? missing & empty : 0;
+    }
+
+    template <size_t... I>
+    static constexpr uint32_t winning_cells(uint32_t pieces, uint32_t empty, std::index_sequence<I...>) {
+        return (missing_cell(pieces, empty, win_masks[I]) | ...);
+    }
+
+    template <size_t... I>
+    static constexpr uint32_t transform(uint32_t bits, int symmetry, std::index_sequence<I...>) {
+        return (symmetry_lut[symmetry][I][bits >> (8 * I) & 0xFF] | ...);
+    }
+};
+
+inline int side(int player) {
+    return player == 1 ? 0 : 1;
+}
+
+// Two bitmasks, one per player (bit i set = player occupies cell i)
+template <class Game>
+struct BitBoard {
+    using game = Game;
+
+    uint32_t bits[2] = {0, 0};
+    uint64_t hashes[8] = {}; // Zobrist hash of the board under each symmetry, updated incrementally by make_move/unmake_move
+
+    int at(int cell) const {
+        if (bits[0] >> cell & 1) {
+            return 1;
+        }
+        if (bits[1] >> cell & 1) {
+            return -1;
+        }
+        return 0;
+    }
+
+    uint32_t empty_cells() const {
+        return ~(bits[0] | bits[1]) & Game::full_board;
+    }
+
+    // Smallest of the 8 symmetric hashes, so all symmetric positions share one TT entry
+    uint64_t canonical_hash(int& symmetry) const {
+        symmetry = 0;
+        for (int i = 1; i < 8; ++i) {
+            if (hashes[i] < hashes[symmetry]) {
+                symmetry = i;
+            }
+        }
+        return hashes[symmetry];
+    }
+
+    // Canonical hash that also tells the side to move apart. Within one game the piece counts decide it, but a
+    // table that outlives the game sees the same pieces with either player to move, depending on who started.
+    uint64_t position_key(int player, int& symmetry) const {
+        return canonical_hash(symmetry) ^ (player == 1 ? 0 : 0x6A09E667F3BCC909);
+    }
+
+    void make_move(int cell, int player) {
+        bits[side(player)] |= 1u << cell;
+        for (int i = 0; i < 8; ++i) {
+            hashes[i] ^= Game::zobrist_keys[Game::symmetry_maps[i][cell]][side(player)];
+        }
+    }
+
+    void unmake_move(int cell, int player) {
+        bits[side(player)] &= ~(1u << cell);
+        for (int i = 0; i < 8; ++i) {
+            hashes[i] ^= Game::zobrist_keys[Game::symmetry_maps[i][cell]][side(player)];
+        }
+    }
+};
+
+// Symmetry whose image of the board has the smallest packed bitboards; that image is the canonical form
+template <class Game>
+int canonical_symmetry(const BitBoard<Game>& gameboard) {
+    int symmetry = 0;
+    uint64_t best_key = UINT64_MAX;
+    for (int i = 0; i < 8; ++i) {
+        uint64_t key = Game::transform(gameboard.bits[0], i) | (uint64_t)Game::transform(gameboard.bits[1], i) << 32;
+        if (key < best_key) {
+            best_key = key;
+            symmetry = i;
+        }
+    }
+    return symmetry;
+}
+
+template <class Game>
+void display_board(const BitBoard<Game>& gameboard) {
+    for (int i = 0; i < Game::cells; ++i) {
+        char symbol = (gameboard.at(i) == 1) ? 'O' : ((gameboard.at(i) == -1) ? 'X' : ' ');
+        std::cout << symbol;
+        if ((i + 1) % Game::size == 0) {
+            std::cout << std::endl;
+            if (i < Game::cells - 1) {
+                std::cout << std::string(4 * Game::size - 3, '-') << std::endl;
+            }
+        } else {
+            std::cout << " | ";
+        }
+    }
+}
+
+template <class Game>
+bool check_win(const BitBoard<Game>& gameboard, const int& player) {
+    return Game::has_line(gameboard.bits[side(player)]);
+}
+
+// Bitmask of the empty cells, iterated lowest cell first with ctz
+template <class Game>
+uint32_t get_possible_moves(const BitBoard<Game>& gameboard) {
+    return gameboard.empty_cells();
+}
+
+// Terminal checks for many boards at once (tablebase generation, batch analysis). first[i] and second[i] are
+// board i's bitboards for player 1 and player -1, and flags[i] gets the bits below. The SIMD kernels test every
+// win mask against 4 (SSE4.1) or 8 (AVX2) boards per instruction, for both players, and check_win_batch picks
+// the widest one the CPU supports the first time it is called.
+enum BoardFlags : uint8_t { LINE_PLAYER_1 = 1, LINE_PLAYER_2 = 2, BOARD_FULL = 4 };
+
+using CheckWinBatch = void (*)(const uint32_t* first, const uint32_t* second, size_t count, uint8_t* flags);
+
+template <class Game>
+void check_win_batch_scalar(const uint32_t* first, const uint32_t* second, size_t count, uint8_t* flags) {
+    for (size_t i = 0; i < count; ++i) {
+        flags[i] = (Game::has_line(first[i]) ? LINE_PLAYER_1 : 0) | (Game::has_line(second[i]) ? LINE_PLAYER_2 : 0) | ((first[i] | second[i]) == Game::full_board ? BOARD_FULL : 0);
+    }
+}
+
+#ifdef ENGINE_X86
+template <class Game>
+__attribute__((target("sse4.1"))) void check_win_batch_sse4(const uint32_t* first, const uint32_t* second, size_t count, uint8_t* flags) {
+    const __m128i full = _mm_set1_epi32(Game::full_board);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(first + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(second + i));
+        __m128i line_a = _mm_setzero_si128(), line_b = _mm_setzero_si128();
+        for (uint32_t mask : Game::win_masks) {
+            __m128i m = _mm_set1_epi32(mask);
+            line_a = _mm_or_si128(line_a, _mm_cmpeq_epi32(_mm_and_si128(a, m), m));
+            line_b = _mm_or_si128(line_b, _mm_cmpeq_epi32(_mm_and_si128(b, m), m));
+        }
+        __m128i is_full = _mm_cmpeq_epi32(_mm_or_si128(a, b), full);
+
+        __m128i lanes = _mm_or_si128(_mm_and_si128(line_a, _mm_set1_epi32(LINE_PLAYER_1)), _mm_or_si128(_mm_and_si128(line_b, _mm_set1_epi32(LINE_PLAYER_2)), _mm_and_si128(is_full, _mm_set1_epi32(BOARD_FULL))));
+        lanes = _mm_packus_epi32(lanes, lanes);
+        lanes = _mm_packus_epi16(lanes, lanes);
+        uint32_t packed = _mm_cvtsi128_si32(lanes);
+        std::copy((const uint8_t*)&packed, (const uint8_t*)&packed + 4, flags + i);
+    }
+    check_win_batch_scalar<Game>(first + i, second + i, count - i, flags + i);
+}
+
+template <class Game>
+__attribute__((target("avx2"))) void check_win_batch_avx2(const uint32_t* first, const uint32_t* second, size_t count, uint8_t* flags) {
+    const __m256i full = _mm256_set1_epi32(Game::full_board);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(first + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(second + i));
+        __m256i line_a = _mm256_setzero_si256(), line_b = _mm256_setzero_si256();
+        for (uint32_t mask : Game::win_masks) {
+            __m256i m = _mm256_set1_epi32(mask);
+            line_a = _mm256_or_si256(line_a, _mm256_cmpeq_epi32(_mm256_and_si256(a, m), m));
+            line_b = _mm256_or_si256(line_b, _mm256_cmpeq_epi32(_mm256_and_si256(b, m), m));
+        }
+        __m256i is_full = _mm256_cmpeq_epi32(_mm256_or_si256(a, b), full);
+
+        __m256i lanes = _mm256_or_si256(_mm256_and_si256(line_a, _mm256_set1_epi32(LINE_PLAYER_1)), _mm256_or_si256(_mm256_and_si256(line_b, _mm256_set1_epi32(LINE_PLAYER_2)), _mm256_and_si256(is_full, _mm256_set1_epi32(BOARD_FULL))));
+        // Narrow each 128-bit half to 4 bytes; packs work within halves, so the halves are stored separately
+        __m128i low = _mm256_castsi256_si128(lanes), high = _mm256_extracti128_si256(lanes, 1);
+        low = _mm_packus_epi16(_mm_packus_epi32(low, high), _mm_setzero_si128());
+        _mm_storel_epi64((__m128i*)(flags + i), low); // Not _mm_cvtsi128_si64, which 32-bit x86 lacks
+    }
+    check_win_batch_scalar<Game>(first + i, second + i, count - i, flags + i);
+}
+#endif
+
+template <class Game>
+CheckWinBatch select_check_win_batch() {
+#ifdef ENGINE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return check_win_batch_avx2<Game>;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return check_win_batch_sse4<Game>;
+    }
+#endif
+    return check_win_batch_scalar<Game>;
+}
+
+template <class Game>
+void check_win_batch(const uint32_t* first, const uint32_t* second, size_t count, uint8_t* flags) {
+    static const CheckWinBatch kernel = select_check_win_batch<Game>();
+    kernel(first, second, count, flags);
+}
+
+// Boards per second for check_win one board at a time against each batch kernel the CPU supports, on random
+// positions (kernels that disagree with check_win are reported)
+template <class Game>
+void benchmark_check_win(size_t count = 1 << 20) {
+    const int repetitions = 20;
+    std::vector<uint32_t> first(count), second(count);
+    std::vector<uint8_t> expected(count), flags(count);
+
+    uint64_t seed = 1;
+    for (size_t i = 0; i < count; ++i) {
+        BitBoard<Game> gameboard;
+        for (int cell = 0; cell < Game::cells; ++cell) {
+            seed = seed * 6364136223846793005 + 1442695040888963407;
+            int piece = seed >> 61; // 0-7: mostly filled boards, some with lines and some full
+            if (piece < 3) {
+                gameboard.make_move(cell, 1);
+            } else if (piece < 6) {
+                gameboard.make_move(cell, -1);
+            }
+        }
+        first[i] = gameboard.bits[0];
+        second[i] = gameboard.bits[1];
+        expected[i] = (check_win(gameboard, 1) ? LINE_PLAYER_1 : 0) | (check_win(gameboard, -1) ? LINE_PLAYER_2 : 0) | (gameboard.empty_cells() == 0 ? BOARD_FULL : 0);
+    }
+
+    auto time = [&](auto run) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (int repetition = 0; repetition < repetitions; ++repetition) {
+            run();
+        }
+        std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start_time;
+        return count * repetitions / duration.count() / 1e6;
+    };
+
+    std::cout << "kernel\tmillion_boards_per_s" << std::endl;
+    double rate = time([&] {
+        for (size_t i = 0; i < count; ++i) {
+            BitBoard<Game> gameboard;
+            gameboard.bits[0] = first[i];
+            gameboard.bits[1] = second[i];
+            flags[i] = (check_win(gameboard, 1) ? LINE_PLAYER_1 : 0) | (check_win(gameboard, -1) ? LINE_PLAYER_2 : 0) | (gameboard.empty_cells() == 0 ? BOARD_FULL : 0);
+        }
+    });
+    std::cout << "check_win\t" << std::fixed << std::setprecision(1) << rate << std::endl;
+
+    std::vector<std::pair<const char*, CheckWinBatch>> kernels = {{"scalar", check_win_batch_scalar<Game>}};
+#ifdef ENGINE_X86
+    if (__builtin_cpu_supports("sse4.1")) {
+        kernels.push_back({"sse4.1", check_win_batch_sse4<Game>});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"avx2", check_win_batch_avx2<Game>});
+    }
+#endif
+    for (auto& [name, kernel] : kernels) {
+        rate = time([&] { kernel(first.data(), second.data(), count, flags.data()); });
+        std::cout << name << "\t" << rate << (flags == expected ? "" : "\tMISMATCH") << std::endl;
+    }
+}
+
+// Nodes searched by this thread, counted by each program's negamax
+inline thread_local uint64_t searched_nodes = 0;
+
+// Transposition table lookups by this thread, and how many found an entry for the position (with ENGINE_STATS)
+inline thread_local uint64_t table_probes = 0;
+inline thread_local uint64_t table_hits = 0;
+
+// Flag polled by this thread's search. Setting it abandons the search: negamax returns 0 from every node and stores
+// nothing, so the caller must throw the result away. Threads point it at the flag of whoever they search for.
+inline std::atomic<bool> never_stop(false);
+inline thread_local std::atomic<bool>* stop_search = &never_stop;
+
+// Counters that cost something in the hot paths are only kept when built with -DENGINE_STATS: ENGINE_STAT(...)
+// runs its statement then and compiles to nothing otherwise.
+#ifdef ENGINE_STATS
+#define ENGINE_STAT(...) do { __VA_ARGS__; } while (0)
+#else
+#define ENGINE_STAT(...) do {} while (0)
+#endif
+
+// Statistics of this thread's last solve(). Nodes and time are always filled in; table lookups, cutoffs and
+// overwrites, the cutoff index histogram and the per-iteration figures need ENGINE_STATS. Helper threads of a
+// parallel search count on their own and are added in when they join (see HelperCounters), so the per-iteration
+// node counts only cover this thread.
+struct SearchStats {
+    static constexpr int max_move_index = 32;
+
+    struct Iteration {
+        int depth;
+        uint64_t nodes;   // Both counted from the start of the solve
+        uint64_t time_us;
+    };
+
+    uint64_t nodes = 0;
+    uint64_t time_us = 0;
+    uint64_t table_probes = 0;
+    uint64_t table_hits = 0;
+    uint64_t table_cutoffs = 0;                 // Nodes answered by a table entry
+    uint64_t table_overwrites = 0;              // Entries of other positions replaced by a save
+    uint64_t cutoff_index[max_move_index] = {}; // Beta cutoffs by the position of the move in the ordered list
+    std::vector<Iteration> iterations;          // Completed iterative deepening depths
+
+    std::chrono::steady_clock::time_point start_time;
+    uint64_t start_nodes = 0, start_probes = 0, start_hits = 0;
+
+    void begin() {
+        *this = SearchStats();
+        start_time = std::chrono::steady_clock::now();
+        start_nodes = searched_nodes;
+        start_probes = ::table_probes;
+        start_hits = ::table_hits;
+    }
+
+    void finish() {
+        nodes = searched_nodes - start_nodes;
+        time_us = elapsed_us();
+        table_probes = ::table_probes - start_probes;
+        table_hits = ::table_hits - start_hits;
+    }
+
+    uint64_t elapsed_us() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    void add_iteration(int depth) {
+        iterations.push_back({depth, searched_nodes - start_nodes, elapsed_us()});
+    }
+
+    uint64_t nodes_per_second() const {
+        return time_us == 0 ? 0 : nodes * 1000000 / time_us;
+    }
+
+    // One line of JSON
+    void write_json(std::ostream& out) const {
+        out << "{\"nodes\":" << nodes << ",\"time_us\":" << time_us << ",\"nps\":" << nodes_per_second()
+            << ",\"table\":{\"probes\":" << table_probes << ",\"hits\":" << table_hits << ",\"cutoffs\":" << table_cutoffs << ",\"overwrites\":" << table_overwrites << "}"
+            << ",\"cutoff_index\":[";
+        int used = max_move_index;
+        while (used > 0 && cutoff_index[used - 1] == 0) {
+            used--;
+        }
+        for (int i = 0; i < used; ++i) {
+            out << (i > 0 ? "," : "") << cutoff_index[i];
+        }
+        out << "],\"iterations\":[";
+        for (size_t i = 0; i < iterations.size(); ++i) {
+            out << (i > 0 ? "," : "") << "{\"depth\":" << iterations[i].depth << ",\"nodes\":" << iterations[i].nodes << ",\"time_us\":" << iterations[i].time_us << "}";
+        }
+        out << "]}" << std::endl;
+    }
+};
+
+inline thread_local SearchStats search_stats;
+
+// Held by solve() so search_stats covers exactly one solve, whichever way it returns
+struct SearchStatsScope {
+    SearchStatsScope() {
+        search_stats.begin();
+    }
+
+    ~SearchStatsScope() {
+        search_stats.finish();
+    }
+};
+
+// Counters of the threads a parallel search starts to help one solve(). Each helper calls collect() as its last
+// step, which adds everything its thread counted (a helper thread only ever works for the one solve), and the
+// solving thread calls merge() once they are joined, adding the total to its own counters and search_stats.
+struct HelperCounters {
+    std::mutex lock;
+    uint64_t nodes = 0, probes = 0, hits = 0, table_cutoffs = 0, table_overwrites = 0;
+    uint64_t cutoff_index[SearchStats::max_move_index] = {};
+
+    void collect() {
+        std::lock_guard<std::mutex> guard(lock);
+        nodes += searched_nodes;
+        probes += table_probes;
+        hits += table_hits;
+        table_cutoffs += search_stats.table_cutoffs;
+        table_overwrites += search_stats.table_overwrites;
+        for (int i = 0; i < SearchStats::max_move_index; ++i) {
+            cutoff_index[i] += search_stats.cutoff_index[i];
+        }
+    }
+
+    void merge() {
+        std::lock_guard<std::mutex> guard(lock);
+        searched_nodes += nodes;
+        ::table_probes += probes;
+        ::table_hits += hits;
+        search_stats.table_cutoffs += table_cutoffs;
+        search_stats.table_overwrites += table_overwrites;
+        for (int i = 0; i < SearchStats::max_move_index; ++i) {
+            search_stats.cutoff_index[i] += cutoff_index[i];
+        }
+    }
+};
+
+// Appends search_stats to path ("-" for standard output), for --stats FILE
+inline void write_search_stats(const std::string& path) {
+    if (path == "-") {
+        search_stats.write_json(std::cout);
+        return;
+    }
+    std::ofstream out(path, std::ios::app);
+    if (!out) {
+        std::cerr << "Unable to write " << path << std::endl;
+        return;
+    }
+    search_stats.write_json(out);
+}
+
+struct TTEntry {
+    int best_score;
+    int depth;
+    int flag;
+    int best_move;
+};
+
+// Fixed-size cache of 64 byte buckets, each holding four entries. Entries are two 64-bit words: the packed
+// data and the hash XOR the data, so a torn write from another thread just fails the key check (no locks).
+// Instead of true LRU every entry records the generation (solve() call) it was written in, and the victim
+// is the slot with the lowest depth after penalising old generations.
+// The table can also live in a file mapped shared, so it outlasts the process and several processes can use it
+// at once (the key check covers them the same way). Only the exact solvers use that: their scores depend on
+// the position alone, so entries stay true from one run to the next.
+struct TranspositionTable {
+    struct Slot {
+        std::atomic<uint64_t> key{0};
+        std::atomic<uint64_t> data{0};
+    };
+
+    struct alignas(64) Bucket {
+        Slot slots[4];
+    };
+
+    // Start of a table file, padded so the buckets after it stay cache-line aligned
+    struct alignas(64) FileHeader {
+        char magic[8];
+        char tag[8];
+        uint64_t bucket_count;
+    };
+
+    Bucket* buckets = nullptr;
+    std::unique_ptr<Bucket[]> owned_buckets;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    uint64_t index_mask = 0;
+    std::atomic<uint8_t> generation{0};
+
+    static size_t bucket_count(size_t size_mb) {
+        size_t count = 1;
+        while (count * 2 * sizeof(Bucket) <= size_mb * 1024 * 1024) {
+            count *= 2;
+        }
+        return count;
+    }
+
+    explicit TranspositionTable(size_t size_mb) {
+        size_t count = bucket_count(size_mb);
+        owned_buckets.reset(new Bucket[count]);
+        buckets = owned_buckets.get();
+        index_mask = count - 1;
+    }
+
+    // Table kept in path, which is created (or started over if it was made for another tag or size) as needed.
+    // tag names the game and its scoring, so a file is never read with the wrong meaning. Falls back to memory
+    // if the file can't be used. A file is only ever grown, never shrunk: other processes may have it mapped, and
+    // touching a page past the end of the file would kill them with SIGBUS.
+    TranspositionTable(size_t size_mb, const std::string& path, const char (&tag)[8]) {
+        const char magic[8] = {'T', 'T', 'C', 'A', 'C', 'H', 'E', '1'};
+        size_t count = bucket_count(size_mb);
+        size_t size = sizeof(FileHeader) + count * sizeof(Bucket);
+
+        int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            std::cerr << "Unable to open " << path << ", using an in-memory table." << std::endl;
+            *this = TranspositionTable(size_mb);
+            return;
+        }
+
+        // Only one process sets the file up
+        flock(fd, LOCK_EX);
+        struct stat info;
+        FileHeader header = {};
+        bool usable = fstat(fd, &info) == 0 && ((size_t)info.st_size >= size || ftruncate(fd, size) == 0);
+        bool valid = usable && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                     memcmp(header.magic, magic, 8) == 0 && memcmp(header.tag, tag, 8) == 0 && header.bucket_count == count;
+        void* data = usable ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (!valid && data != MAP_FAILED) {
+            // Started over in place, clearing whatever was there before the file grew (the rest reads as zeros)
+            size_t used = std::min((size_t)info.st_size, size);
+            if (used > sizeof(FileHeader)) {
+                memset((char*)data + sizeof(FileHeader), 0, used - sizeof(FileHeader));
+            }
+            memcpy(header.magic, magic, 8);
+            memcpy(header.tag, tag, 8);
+            header.bucket_count = count;
+            memcpy(data, &header, sizeof(header));
+        }
+        flock(fd, LOCK_UN);
+        close(fd);
+
+        if (data == MAP_FAILED) {
+            std::cerr << "Unable to map " << path << ", using an in-memory table." << std::endl;
+            *this = TranspositionTable(size_mb);
+            return;
+        }
+        mapping = data;
+        mapping_size = size;
+        buckets = (Bucket*)((char*)data + sizeof(FileHeader));
+        index_mask = count - 1;
+    }
+
+    TranspositionTable(const TranspositionTable&) = delete;
+
+    TranspositionTable& operator=(TranspositionTable&& other) {
+        release();
+        buckets = other.buckets;
+        owned_buckets = std::move(other.owned_buckets);
+        mapping = other.mapping;
+        mapping_size = other.mapping_size;
+        index_mask = other.index_mask;
+        other.mapping = nullptr;
+        return *this;
+    }
+
+    ~TranspositionTable() {
+        release();
+    }
+
+    void release() {
+        if (mapping) {
+            munmap(mapping, mapping_size);
+            mapping = nullptr;
+        }
+    }
+
+    // data layout: score (16 bits) | depth (8) | flag + 2, 0 = empty (2) | best move (6) | generation (8)
+    static uint64_t pack(int best_score, int depth, int flag, int best_move, uint8_t generation) {
+        return (uint64_t)(uint16_t)best_score | (uint64_t)depth << 16 | (uint64_t)(flag + 2) << 24 | (uint64_t)best_move << 26 | (uint64_t)generation << 32;
+    }
+
+    int age(uint64_t data) const {
+        return (uint8_t)(generation.load(std::memory_order_relaxed) - (uint8_t)(data >> 32));
+    }
+
+    void new_search() {
+        generation.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void clear() {
+        for (uint64_t i = 0; i <= index_mask; ++i) {
+            for (Slot& slot : buckets[i].slots) {
+                slot.key.store(0, std::memory_order_relaxed);
+                slot.data.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool probe(uint64_t hash, TTEntry& entry) const {
+        const Bucket& bucket = buckets[hash & index_mask];
+        for (const Slot& slot : bucket.slots) {
+            uint64_t data = slot.data.load(std::memory_order_relaxed);
+            if ((slot.key.load(std::memory_order_relaxed) ^ data) == hash && (data >> 24 & 3) != 0) {
+                entry.best_score = (int16_t)(data & 0xFFFF);
+                entry.depth = data >> 16 & 0xFF;
+                entry.flag = (int)(data >> 24 & 3) - 2;
+                entry.best_move = data >> 26 & 0x3F;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void save(uint64_t hash, int best_score, int depth, int flag, int best_move) {
+        Bucket& bucket = buckets[hash & index_mask];
+        Slot* victim = &bucket.slots[0];
+        int victim_worth = 1 << 30;
+
+        for (Slot& slot : bucket.slots) {
+            uint64_t data = slot.data.load(std::memory_order_relaxed);
+            if ((data >> 24 & 3) == 0 || (slot.key.load(std::memory_order_relaxed) ^ data) == hash) {
+                victim = &slot;
+                break;
+            }
+
+            int worth = (int)(data >> 16 & 0xFF) - 8 * age(data);
+            if (worth < victim_worth) {
+                victim_worth = worth;
+                victim = &slot;
+            }
+        }
+
+        ENGINE_STAT(
+            uint64_t old = victim->data.load(std::memory_order_relaxed);
+            if ((old >> 24 & 3) != 0 && (victim->key.load(std::memory_order_relaxed) ^ old) != hash) {
+                search_stats.table_overwrites++;
+            }
+        );
+
+        uint64_t data = pack(best_score, depth, flag, best_move, generation.load(std::memory_order_relaxed));
+        victim->key.store(hash ^ data, std::memory_order_relaxed);
+        victim->data.store(data, std::memory_order_relaxed);
+    }
+};
+
+// Saves a search result with its bound type: 1 for an upper bound (failed low), -1 for a lower bound (failed high),
+// 0 for an exact score
+inline void store(TranspositionTable& table, uint64_t hash, int alpha_org, int beta, int best_score, int depth, int best_move) {
+    int flag = best_score <= alpha_org ? 1 : (best_score >= beta ? -1 : 0);
+    table.save(hash, best_score, depth, flag, best_move);
+}
+
+// Move ordering: the transposition table's best move, then the two killer moves for this depth (moves that
+// caused a cutoff in a sibling subtree), then the history score (cutoffs caused by the move anywhere, weighted
+// by depth squared), with cells nearest the centre breaking ties. Killers are indexed by remaining depth, which
+// within one search is the ply counted from the leaves.
+template <class Game>
+struct MoveOrdering {
+    static constexpr int max_depth = 64;
+
+    int killers[max_depth][2];
+    int history[2][Game::cells];
+    int center_rank[Game::cells];
+    uint64_t cutoffs = 0;            // Nodes that failed high
+    uint64_t first_move_cutoffs = 0; // ... on the first move searched
+
+    MoveOrdering() {
+        for (int i = 0; i < Game::cells; ++i) {
+            center_rank[Game::center_order[i]] = i;
+        }
+        clear();
+    }
+
+    void clear() {
+        std::fill(&killers[0][0], &killers[0][0] + max_depth * 2, -1);
+        std::fill(&history[0][0], &history[0][0] + 2 * Game::cells, 0);
+        cutoffs = first_move_cutoffs = 0;
+    }
+
+    // Called at the start of each solve(): old history still helps but should not dominate
+    void new_search() {
+        for (int& score : history[0]) score /= 4;
+        for (int& score : history[1]) score /= 4;
+        cutoffs = first_move_cutoffs = 0;
+    }
+
+    // Writes the moves in possible to moves[], best first, and returns how many there are
+    int order(uint32_t possible, int hash_move, int depth, int player, int* moves) const {
+        const int* killer = killers[std::min(depth, max_depth - 1)];
+        int keys[Game::cells];
+        int count = 0;
+
+        for (; possible; possible &= possible - 1) {
+            int move = __builtin_ctz(possible);
+            int key;
+            if (move == hash_move) {
+                key = 1 << 30;
+            } else if (move == killer[0]) {
+                key = 1 << 29;
+            } else if (move == killer[1]) {
+                key = 1 << 28;
+            } else {
+                key = history[side(player)][move] * 32 + (Game::cells - center_rank[move]);
+            }
+
+            // Insertion sort, at most one move per cell
+            int i = count++;
+            for (; i > 0 && keys[i - 1] < key; --i) {
+                keys[i] = keys[i - 1];
+                moves[i] = moves[i - 1];
+            }
+            keys[i] = key;
+            moves[i] = move;
+        }
+        return count;
+    }
+
+    // move_index is the position of the move in the ordered list
+    void record_cutoff(int move, int move_index, int depth, int player) {
+        cutoffs++;
+        if (move_index == 0) {
+            first_move_cutoffs++;
+        }
+        ENGINE_STAT(search_stats.cutoff_index[std::min(move_index, SearchStats::max_move_index - 1)]++);
+
+        int* killer = killers[std::min(depth, max_depth - 1)];
+        if (killer[0] != move) {
+            killer[1] = killer[0];
+            killer[0] = move;
+        }
+
+        int& score = history[side(player)][move];
+        score += depth * depth;
+        if (score > 1 << 20) {
+            for (int& other : history[side(player)]) other /= 2;
+        }
+    }
+
+    double first_move_cutoff_rate() const {
+        return cutoffs == 0 ? 0.0 : 100.0 * first_move_cutoffs / cutoffs;
+    }
+};
+
+// One per thread, so parallel searches order moves without sharing (or locking) anything
+template <class Game>
+thread_local MoveOrdering<Game> move_ordering;
+
+// Triangular principal variation table, indexed by remaining depth like the killers: lines[d] is the best line
+// found below the current node with d plies left. A node clears its line on entry and a move that raises alpha
+// becomes the move followed by its child's line. The line kept from the last iteration is searched first on the
+// next one for as long as the search is still following it.
+template <class Game>
+struct PrincipalVariation {
+    static constexpr int max_depth = 64;
+
+    int lines[max_depth][max_depth];
+    int lengths[max_depth] = {};
+    int previous[max_depth];
+    int previous_length = 0;
+    int root_depth = 0;
+    bool following = false;
+
+    void clear() {
+        previous_length = 0;
+        following = false;
+    }
+
+    // Start of a pass over the root moves
+    void start_pass(int depth) {
+        root_depth = depth;
+        lengths[depth] = 0;
+        following = true;
+    }
+
+    // Start of a node: returns the kept line's move for this ply while the path so far is that line, else -1.
+    // The caller sets following to false once its first child has been searched.
+    int enter(int depth) {
+        lengths[depth] = 0;
+        int ply = root_depth - depth;
+        if (following && ply >= 0 && ply < previous_length) {
+            return previous[ply];
+        }
+        following = false;
+        return -1;
+    }
+
+    // move raised alpha at a node with depth (at least 1) plies left
+    void update(int depth, int move) {
+        lines[depth][0] = move;
+        int length = lengths[depth - 1];
+        std::copy(lines[depth - 1], lines[depth - 1] + length, lines[depth] + 1);
+        lengths[depth] = length + 1;
+    }
+
+    // Keep a line to follow on the next pass, by default the one just found at the root
+    void keep(const int* line, int length) {
+        std::copy(line, line + length, previous);
+        previous_length = length;
+    }
+
+    void keep() {
+        keep(lines[root_depth], lengths[root_depth]);
+    }
+};
+
+template <class Game>
+thread_local PrincipalVariation<Game> principal_variation;
+
+// Share of fail-high nodes that failed high on their first move (this thread's nodes), printed after an AI move.
+// Near 100% means the ordering almost always finds the refutation first, so alpha-beta is close to its best case.
+template <class Game>
+void report_move_ordering() {
+    MoveOrdering<Game>& ordering = move_ordering<Game>;
+    if (ordering.cutoffs > 0) {
+        std::cout << "Cutoffs on the first move: " << std::fixed << std::setprecision(1) << ordering.first_move_cutoff_rate() << "% of " << ordering.cutoffs << std::endl;
+    }
+    ordering.cutoffs = ordering.first_move_cutoffs = 0;
+}
+
+// Share of this thread's table lookups that found their position, printed after an AI move. When the table is kept
+// for the whole game this climbs from the second move on, as the positions searched last turn come round again.
+// Lookups are only counted with ENGINE_STATS, so without it nothing is printed.
+inline void report_table_hits() {
+    if (table_probes > 0) {
+        std::cout << "Table hits: " << std::fixed << std::setprecision(1) << 100.0 * table_hits / table_probes << "% of " << table_probes << " lookups" << std::endl;
+    }
+    table_probes = table_hits = 0;
+}
+
+// Transposition table lookup shared by every game's negamax. Returns true with the node's value if the table
+// answers it, otherwise alpha and beta may have been narrowed and hash_move is the table's best move for this board
+// (-1 if none), in the frame symmetry maps back to. Entries searched deeper than depth are used as well unless
+// exact_depth is set, for searches whose scores mean something else at another depth.
+template <class Game>
+bool probe_table(uint64_t hash, int symmetry, int depth, int& alpha, int& beta, TranspositionTable& TT, int& value, int& hash_move, bool exact_depth = false) {
+    hash_move = -1;
+
+    TTEntry tt_entry;
+    ENGINE_STAT(table_probes++);
+    if (!TT.probe(hash, tt_entry)) {
+        return false;
+    }
+    ENGINE_STAT(table_hits++);
+
+    // Get TT data
+    int tt_value = tt_entry.best_score;
+    int tt_depth = tt_entry.depth;
+    int tt_flag = tt_entry.flag;
+    hash_move = Game::inverse_symmetry_maps[symmetry][tt_entry.best_move]; // Searched first even if too shallow to cut off
+
+    if (exact_depth ? tt_depth != depth : tt_depth < depth) {
+        return false;
+    }
+
+    if (tt_flag == 0) {
+        ENGINE_STAT(search_stats.table_cutoffs++);
+        value = tt_value;
+        return true;
+    } else if (tt_flag == -1) {
+        alpha = std::max(alpha, tt_value);
+    } else if (tt_flag == 1) {
+        beta = std::min(beta, tt_value);
+    }
+
+    if (alpha >= beta) {
+        ENGINE_STAT(search_stats.table_cutoffs++);
+        value = tt_value;
+        return true;
+    }
+    return false;
+}
+
+// Exact search for games that are solved to the end: a win scores the remaining depth (so faster wins score
+// higher), a loss minus the remaining depth and a draw 0.
+
+// Depth that solves a position to the end: one more than its empty cells, so a game won on the last cell still
+// scores 1 and not the 0 of a draw
+template <class Game>
+int solve_depth(const BitBoard<Game>& gameboard) {
+    return __builtin_popcount(gameboard.empty_cells()) + 1;
+}
+
+// Transposition table cutoffs and terminal checks for the exact solvers.
+// Returns true with the node's value if it needs no search, otherwise alpha and beta may have been narrowed and
+// hash_move is the table's best move for this board (-1 if none).
+template <class Game>
+bool resolve_node(const BitBoard<Game>& gameboard, uint64_t hash, int symmetry, int player, int depth, int& alpha, int& beta, TranspositionTable& TT, int& value, int& hash_move) {
+    if (probe_table<Game>(hash, symmetry, depth, alpha, beta, TT, value, hash_move)) {
+        return true;
+    }
+
+    // Terminal node checks
+    if (check_win(gameboard, player)) {
+        value = depth;
+        return true;
+    }
+
+    if (check_win(gameboard, -player)) {
+        value = -depth;
+        return true;
+    }
+
+    if (gameboard.empty_cells() == 0 || depth == 0) {
+        value = 0;
+        return true;
+    }
+
+    return false;
+}
+
+// Threat checks for a node that is not over yet (call after the terminal checks). A win scores win_base plus the
+// remaining depth. Returns true with the node's value when the threats decide it: player can complete a line
+// this move, or the opponent threatens two cells and only one can be blocked. If the opponent threatens a single
+// cell, moves is narrowed to that block, since anything else loses on the next move. The loss and the block are
+// only applied with two plies left, so a depth-limited search still sees the same values.
+template <class Game>
+bool resolve_threats(const BitBoard<Game>& gameboard, int player, int depth, int win_base, uint32_t& moves, int& value) {
+    uint32_t empty = gameboard.empty_cells();
+
+    if (Game::winning_cells(gameboard.bits[side(player)], empty)) {
+        value = win_base + depth - 1;
+        return true;
+    }
+
+    if (depth < 2) {
+        return false;
+    }
+
+    uint32_t threats = Game::winning_cells(gameboard.bits[side(-player)], empty);
+    if (threats & (threats - 1)) {
+        value = -(win_base + depth - 2);
+        return true;
+    }
+    if (threats) {
+        moves = threats;
+    }
+    return false;
+}
+
+template <class Game>
+int negamax(BitBoard<Game>& gameboard, int player, int depth, int alpha, int beta, TranspositionTable& TT) {
+    int alpha_org = alpha;
+    searched_nodes++;
+
+    if (stop_search->load(std::memory_order_relaxed)) {
+        return 0;
+    }
+
+    // Transposition table is keyed on the canonical position
+    int symmetry;
+    uint64_t hash = gameboard.position_key(player, symmetry);
+
+    int value, hash_move;
+    if (resolve_node(gameboard, hash, symmetry, player, depth, alpha, beta, TT, value, hash_move)) {
+        return value;
+    }
+
+    uint32_t possible = get_possible_moves(gameboard);
+    if (resolve_threats(gameboard, player, depth, 0, possible, value)) {
+        return value;
+    }
+
+    int best_score = -10000; // Initial best score
+    int best_move = 0;
+    int score;
+
+    MoveOrdering<Game>& ordering = move_ordering<Game>;
+    int moves[Game::cells];
+    int move_count = ordering.order(possible, hash_move, depth, player, moves);
+
+    for (int i = 0; i < move_count; ++i) {
+        int move = moves[i];
+
+        gameboard.make_move(move, player);
+        score = -negamax(gameboard, -player, depth-1, -beta, -alpha, TT);
+        gameboard.unmake_move(move, player);
+
+        if (score > best_score) {
+            best_score = score;
+            best_move = move;
+        }
+
+        alpha = std::max(alpha, score);
+
+        if (alpha >= beta) {
+            ordering.record_cutoff(move, i, depth, player);
+            break;
+        }
+    }
+
+    // An interrupted search returns garbage, so keep it out of the table
+    if (stop_search->load(std::memory_order_relaxed)) {
+        return 0;
+    }
+
+    store(TT, hash, alpha_org, beta, best_score, depth, Game::symmetry_maps[symmetry][best_move]);
+
+    return best_score;
+}
+
+// Root of the exact search: every move with an open window, first best move wins ties
+template <class Game>
+std::tuple<int, int> search_root(BitBoard<Game> gameboard, int player, int depth, TranspositionTable& TT) {
+    int best_move = -1, score;
+    int best_score = -10000; // Initial best score
+    int alpha = -10000; // Initial alpha value
+    int beta = 10000;   // Initial beta value
+
+    for (uint32_t moves = get_possible_moves(gameboard); moves; moves &= moves - 1) {
+        int move = __builtin_ctz(moves);
+
+        gameboard.make_move(move, player);
+        score = -negamax(gameboard, -player, depth-1, -beta, -alpha, TT);
+        gameboard.unmake_move(move, player);
+
+        if (score > best_score) {
+            best_score = score;
+            best_move = move;
+        }
+
+        alpha = std::max(alpha, score);
+    }
+
+    return std::make_tuple(best_move, best_score);
+}
+
+// Board from a string of cell values as written by to_string, one per cell (e.g. "10-10..." for 1, 0, -1, 0).
+// Returns false unless it holds exactly one value per cell and the piece counts could come up in a game.
+template <class Board>
+bool parse_board(const std::string& board_str, Board& gameboard) {
+    gameboard = Board();
+    int cell = 0;
+    for (size_t i = 0; i < board_str.size(); ++i, ++cell) {
+        if (cell == Board::game::cells) {
+            return false;
+        }
+        if (board_str[i] == '-' && i + 1 < board_str.size() && board_str[i + 1] == '1') {
+            gameboard.make_move(cell, -1);
+            ++i;
+        } else if (board_str[i] == '1') {
+            gameboard.make_move(cell, 1);
+        } else if (board_str[i] != '0') {
+            return false;
+        }
+    }
+    int difference = __builtin_popcount(gameboard.bits[0]) - __builtin_popcount(gameboard.bits[1]);
+    return cell == Board::game::cells && difference >= -1 && difference <= 1;
+}
+
+// Side to move in a parsed board: whoever has fewer pieces, and -1 (the AI, as in 4x4_dict.txt) when level
+template <class Game>
+int player_to_move(const BitBoard<Game>& gameboard) {
+    return __builtin_popcount(gameboard.bits[0]) < __builtin_popcount(gameboard.bits[1]) ? 1 : -1;
+}
+
+// Score of a finished game for the side to move, as the search scores it with depth plies left (win_base plus
+// the depth for a win). Returns false if the game is not over.
+template <class Game>
+bool game_over_score(const BitBoard<Game>& gameboard, int player, int depth, int win_base, int& score) {
+    if (check_win(gameboard, player)) {
+        score = win_base + depth;
+    } else if (check_win(gameboard, -player)) {
+        score = -win_base - depth;
+    } else if (gameboard.empty_cells() == 0) {
+        score = 0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// One line of batch output, "board move score nodes time_us", timing solve() and counting the nodes of this thread
+// and of any helpers it joined
+template <class Solve>
+std::string batch_line(const std::string& board_str, Solve solve) {
+    searched_nodes = 0;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    std::tuple<int, int> result = solve();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start_time);
+    return board_str + " " + std::to_string(std::get<0>(result)) + " " + std::to_string(std::get<1>(result)) + " " + std::to_string(searched_nodes) + " " + std::to_string(duration.count());
+}
+
+// The table a solve() searches: table when given (a game's own, kept from move to move), otherwise cache (the
+// --cache file) if there is one, otherwise a fresh table of size_mb held in local for the length of the solve
+inline TranspositionTable& select_table(TranspositionTable* table, TranspositionTable* cache, std::unique_ptr<TranspositionTable>& local, size_t size_mb) {
+    if (table) {
+        return *table;
+    }
+    if (cache) {
+        return *cache;
+    }
+    local.reset(new TranspositionTable(size_mb));
+    return *local;
+}
+
+// This batch thread's table: cache when given, otherwise one of size_mb made for the thread's first position and
+// kept from position to position (solve() ages the old entries with new_search())
+inline TranspositionTable* batch_table(size_t size_mb, TranspositionTable* cache = nullptr) {
+    static thread_local std::unique_ptr<TranspositionTable> table;
+    if (cache) {
+        return cache;
+    }
+    if (!table) {
+        table.reset(new TranspositionTable(size_mb));
+    }
+    return table.get();
+}
+
+// Batch line for the games solved to the end. The first field of the line is the board (as in 4x4_dict.txt), the
+// rest is ignored. solve(gameboard, player, depth, table) searches it to depth_of(gameboard) on batch_table().
+template <class Game, class Depth, class Solve>
+std::string analyse_batch_line(const std::string& line, Depth depth_of, size_t table_mb, TranspositionTable* cache, Solve solve) {
+    std::string board_str;
+    std::istringstream(line) >> board_str;
+
+    BitBoard<Game> gameboard;
+    if (!parse_board(board_str, gameboard)) {
+        std::cerr << "Skipping invalid board: " << line << std::endl;
+        return "";
+    }
+    int player = player_to_move(gameboard);
+    int depth = depth_of(gameboard);
+    TranspositionTable* table = batch_table(table_mb, cache);
+
+    return batch_line(board_str, [&] {
+        int score;
+        if (game_over_score(gameboard, player, depth, 0, score)) {
+            return std::make_tuple(-1, score);
+        }
+        return solve(gameboard, player, depth, table);
+    });
+}
+
+// Batch analysis: reads one position per line and hands each line to analyse(), which returns its output line
+// (empty to skip it). Lines are read a chunk at a time; the worker threads are started once for the whole run and
+// take the chunk's lines from a shared index, then the chunk is written in input order. So only one chunk is ever
+// held in memory whatever the size of the input, and anything a worker keeps per thread (such as its table) lasts
+// from chunk to chunk.
+template <class Analyse>
+void run_batch(std::istream& in, std::ostream& out, int threads, Analyse analyse) {
+    const size_t chunk_size = 256;
+    std::vector<std::string> lines, results;
+    std::string line;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::atomic<size_t> next(0);
+    uint64_t chunk = 0; // Number of the chunk in lines, 0 before the first
+    int busy = 0;       // Workers still on the current chunk
+    bool done = false;
+
+    auto work = [&] {
+        for (size_t i = next++; i < lines.size(); i = next++) {
+            results[i] = analyse(lines[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int id = 1; id < threads; ++id) {
+        workers.emplace_back([&] {
+            uint64_t seen = 0;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [&] { return done || chunk != seen; });
+                    if (done) {
+                        return;
+                    }
+                    seen = chunk;
+                }
+                work();
+                std::lock_guard<std::mutex> guard(lock);
+                if (--busy == 0) {
+                    changed.notify_all();
+                }
+            }
+        });
+    }
+
+    while (in) {
+        lines.clear();
+        while (lines.size() < chunk_size && std::getline(in, line)) {
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                lines.push_back(line);
+            }
+        }
+        results.assign(lines.size(), std::string());
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            next = 0;
+            busy = (int)workers.size();
+            chunk++;
+        }
+        changed.notify_all();
+        work();
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [&] { return busy == 0; });
+        }
+
+        for (const std::string& result : results) {
+            if (!result.empty()) {
+                out << result << '\n';
+            }
+        }
+        out.flush();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+    }
+    changed.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// run_batch over a file, or standard input if path is "-", writing to standard output
+template <class Analyse>
+bool run_batch_file(const std::string& path, int threads, Analyse analyse) {
+    if (path == "-") {
+        run_batch(std::cin, std::cout, threads, analyse);
+        return true;
+    }
+
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Unable to open " << path << std::endl;
+        return false;
+    }
+    run_batch(file, std::cout, threads, analyse);
+    return true;
+}
+
+
+// Perft: the number of move sequences of exactly depth plies from gameboard, built only on get_possible_moves,
+// make_move/unmake_move and check_win, so a change to any of them shows up as different totals. A game that ends
+// on the way (a line, or a full board) is not played on; the games that end on the last ply are added to ended.
+template <class Game>
+uint64_t perft(BitBoard<Game>& gameboard, int player, int depth, uint64_t& ended) {
+    uint64_t nodes = 0;
+    for (uint32_t moves = get_possible_moves(gameboard); moves; moves &= moves - 1) {
+        int move = __builtin_ctz(moves);
+        gameboard.make_move(move, player);
+        bool over = check_win(gameboard, player) || gameboard.empty_cells() == 0;
+        if (depth == 1) {
+            nodes++;
+            ended += over;
+        } else if (!over) {
+            nodes += perft(gameboard, -player, depth - 1, ended);
+        }
+        gameboard.unmake_move(move, player);
+    }
+    return nodes;
+}
+
+// --perft N: counts(depth, ended) for depths 1 to N, printed as a tab-separated table with the time and nodes per
+// second (a raw move generation benchmark) and checked against expected[depth - 1] = {nodes, ended} where that is
+// known. Returns false if any total differs.
+template <class Count>
+bool run_perft(int max_depth, const std::vector<std::pair<uint64_t, uint64_t>>& expected, Count count) {
+    bool all_match = true;
+    std::cout << "depth\tnodes\tended\tms\tnps\tcheck" << std::endl;
+    for (int depth = 1; depth <= max_depth; ++depth) {
+        uint64_t ended = 0;
+        auto start_time = std::chrono::steady_clock::now();
+        uint64_t nodes = count(depth, ended);
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+
+        std::string check = "-";
+        if (depth <= (int)expected.size()) {
+            bool match = expected[depth - 1] == std::make_pair(nodes, ended);
+            check = match ? "ok" : "MISMATCH (expected " + std::to_string(expected[depth - 1].first) + " " + std::to_string(expected[depth - 1].second) + ")";
+            all_match = all_match && match;
+        }
+        std::cout << depth << "\t" << nodes << "\t" << ended << "\t" << us / 1000 << "\t" << (us == 0 ? 0 : nodes * 1000000 / us) << "\t" << check << std::endl;
+    }
+    return all_match;
+}
+
+// One position of a --bench corpus. reset() runs untimed before every solve so that each one starts from the same
+// state (cleared tables and move ordering), solve() is the part that is timed.
+struct BenchmarkCase {
+    std::string name;
+    std::function<void()> reset;
+    std::function<std::tuple<int, int>()> solve;
+};
+
+// Fixed-corpus benchmark behind every program's --bench: each case is solved warmup times untimed and then reps
+// times timed. Writes a tab-separated table with a header line: the move and score found, the nodes of one solve,
+// the median and fastest time and the nodes per second at the median time, then a total line over all cases.
+// Solves are deterministic, so nodes and moves only change when the search does.
+inline void run_benchmark(const std::string& program, const std::vector<BenchmarkCase>& cases, int warmup, int reps, std::ostream& out) {
+    out << "program\tposition\tmove\tscore\tnodes\tmedian_us\tmin_us\tnps" << std::endl;
+
+    uint64_t total_nodes = 0, total_median = 0, total_min = 0;
+    for (const BenchmarkCase& benchmark : cases) {
+        for (int i = 0; i < warmup; ++i) {
+            benchmark.reset();
+            benchmark.solve();
+        }
+
+        std::tuple<int, int> result;
+        uint64_t nodes = 0;
+        std::vector<uint64_t> times;
+        for (int i = 0; i < std::max(1, reps); ++i) {
+            benchmark.reset();
+            uint64_t start_nodes = searched_nodes;
+            auto start_time = std::chrono::steady_clock::now();
+            result = benchmark.solve();
+            times.push_back(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count());
+            nodes = searched_nodes - start_nodes;
+        }
+
+        std::sort(times.begin(), times.end());
+        uint64_t median = times[times.size() / 2];
+        out << program << "\t" << benchmark.name << "\t" << std::get<0>(result) << "\t" << std::get<1>(result) << "\t" << nodes << "\t"
+            << median << "\t" << times[0] << "\t" << (median == 0 ? 0 : nodes * 1000000 / median) << std::endl;
+
+        total_nodes += nodes;
+        total_median += median;
+        total_min += times[0];
+    }
+    out << program << "\ttotal\t-\t-\t" << total_nodes << "\t" << total_median << "\t" << total_min << "\t" << (total_median == 0 ? 0 : total_nodes * 1000000 / total_median) << std::endl;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Batch regression tests: each tests/<program>_batch.txt is run through the program built with the undefined
+# behaviour sanitizer, and the board, move and score of every line are compared with <program>_batch.expected
+# (node counts and times are left out). Run from the repository: sh tests/run_tests.sh
+set -e
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+status=0
+
+run() {
+    program=$1
+    shift
+    g++ -O1 -pthread -fsanitize=undefined -fno-sanitize-recover=all "$program.cpp" -o "$build/$program"
+    if "$build/$program" --batch "tests/${program}_batch.txt" --threads 1 "$@" | cut -d' ' -f1-3 | diff -u "tests/${program}_batch.expected" -; then
+        echo "$program: ok"
+    else
+        echo "$program: FAILED"
+        status=1
+    fi
+}
+
+# Solved to the end, one table kept across the positions
+run 3x3
+run 4x4
+# Fixed depth so the results don't depend on the machine's speed
+run 5x5 --depth 3
+
+exit $status